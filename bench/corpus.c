@@ -0,0 +1,111 @@
+// Generates the benchmark corpora, the same bytes on every machine.
+//
+// usage: corpus {text|log} {megabytes} {output file}
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15u;
+
+// xorshift64*, good enough for synthetic text
+static uint32_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545f4914f6cdd1du) >> 32);
+}
+
+static const char *pick(const char **list, int size) {
+    return list[rng() % size];
+}
+
+#define COUNT(list) ((int)(sizeof(list) / sizeof(list[0])))
+
+static const char *words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with",
+    "be", "by", "on", "not", "he", "this", "are", "or", "his", "from", "at", "which",
+    "but", "have", "an", "had", "they", "you", "were", "their", "one", "all", "we",
+    "can", "her", "has", "there", "been", "if", "more", "when", "will", "would",
+    "who", "so", "no", "Sherlock", "Holmes", "Watson", "London", "Baker", "street",
+    "never", "gonna", "give", "you", "up", "regular", "expression", "automaton",
+    "state", "transition", "compiler", "kernel", "memory", "bandwidth", "latency",
+};
+
+static const char *punct[] = { "", "", "", "", "", ",", ".", ";", ":", "!", "?" };
+
+// prose with the occasional number, e-mail address and URL
+static void text_line(FILE *out) {
+    int n = 4 + rng() % 14;
+    for (int i = 0; i < n; ++i) {
+        uint32_t r = rng() % 100;
+        if (r < 2) {
+            fprintf(out, "%s.%s@example.%s", pick(words, COUNT(words)), pick(words, COUNT(words)),
+                    rng() % 2 ? "com" : "org");
+        } else if (r < 4) {
+            fprintf(out, "https://www.%s.com/%s/%u", pick(words, COUNT(words)), pick(words, COUNT(words)), rng() % 1000);
+        } else if (r < 8) {
+            fprintf(out, "%u", rng() % 100000);
+        } else {
+            fprintf(out, "%s%s", pick(words, COUNT(words)), pick(punct, COUNT(punct)));
+        }
+        fputc(i + 1 < n ? ' ' : '\n', out);
+    }
+}
+
+static const char *methods[] = { "GET", "GET", "GET", "POST", "PUT", "DELETE", "HEAD" };
+static const char *paths[] = {
+    "/", "/index.html", "/api/v1/users", "/api/v1/orders", "/static/app.js",
+    "/static/style.css", "/login", "/logout", "/search", "/images/logo.png",
+};
+static const char *agents[] = {
+    "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36",
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:121.0) Gecko/20100101 Firefox/121.0",
+    "curl/8.4.0",
+    "Googlebot/2.1 (+http://www.google.com/bot.html)",
+};
+static const char *levels[] = { "INFO", "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+static const char *events[] = {
+    "request completed", "cache miss", "connection reset by peer", "timeout after 3000 ms",
+    "user logged in", "retrying upstream", "slow query", "disk usage above threshold",
+};
+
+// access log lines interleaved with application log lines
+static void log_line(FILE *out) {
+    unsigned day = 1 + rng() % 28, hour = rng() % 24, minute = rng() % 60, second = rng() % 60;
+    if (rng() % 4 != 0) {
+        static const int status[] = { 200, 200, 200, 200, 301, 304, 404, 500, 503 };
+        fprintf(out, "%u.%u.%u.%u - - [%02u/Oct/2024:%02u:%02u:%02u +0000] \"%s %s?id=%u HTTP/1.1\" %d %u \"-\" \"%s\"\n",
+                10 + rng() % 200, rng() % 256, rng() % 256, 1 + rng() % 254,
+                day, hour, minute, second,
+                pick(methods, COUNT(methods)), pick(paths, COUNT(paths)), rng() % 100000,
+                status[rng() % 9], rng() % 50000, pick(agents, COUNT(agents)));
+    } else {
+        fprintf(out, "2024-10-%02u %02u:%02u:%02u.%03u %s [worker-%u] %s request_id=%08x\n",
+                day, hour, minute, second, rng() % 1000,
+                pick(levels, COUNT(levels)), rng() % 16, pick(events, COUNT(events)), rng());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4 || (strcmp(argv[1], "text") && strcmp(argv[1], "log"))) {
+        fprintf(stderr, "usage: corpus {text|log} {megabytes} {output file}\n");
+        return 1;
+    }
+    long size = atol(argv[2]) << 20;
+    FILE *out = fopen(argv[3], "w");
+    if (out == NULL) {
+        perror(argv[3]);
+        return 1;
+    }
+    while (ftell(out) < size) {
+        if (!strcmp(argv[1], "text")) {
+            text_line(out);
+        } else {
+            log_line(out);
+        }
+    }
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,130 @@
+// Times a matcher over every line of a corpus. Linked against the output of
+// regex-to-c, or built with -DREGEXEC to time glibc regcomp/regexec on the
+// same pattern instead.
+//
+// usage: harness {corpus} [regex, with -DREGEXEC]
+// prints: {matching lines}\t{search MB/s}\t{match_n ns per line}
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef REGEXEC
+#include <regex.h>
+
+static regex_t search_re, match_re;
+
+static int search(const unsigned char *buf, size_t len, size_t *start, size_t *end) {
+    regmatch_t m;
+    (void)len;
+    if (regexec(&search_re, (const char *)buf, 1, &m, 0) != 0) {
+        return 0;
+    }
+    *start = m.rm_so;
+    *end = m.rm_eo;
+    return 1;
+}
+
+static ptrdiff_t match_n(const unsigned char *buf, size_t len) {
+    regmatch_t m;
+    (void)len;
+    return regexec(&match_re, (const char *)buf, 1, &m, 0) == 0 ? m.rm_eo : -1;
+}
+
+static void compile(const char *pattern) {
+    char *anchored = malloc(strlen(pattern) + 4);
+    sprintf(anchored, "^(%s)", pattern);
+    if (regcomp(&search_re, pattern, REG_EXTENDED) != 0 || regcomp(&match_re, anchored, REG_EXTENDED) != 0) {
+        fprintf(stderr, "harness: regcomp failed for %s\n", pattern);
+        exit(1);
+    }
+    free(anchored);
+}
+#else
+extern int search(const unsigned char *buf, size_t len, size_t *start, size_t *end);
+extern ptrdiff_t match_n(const unsigned char *buf, size_t len);
+#endif
+
+#define ROUNDS 3
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+#ifdef REGEXEC
+    if (argc != 3) {
+        fprintf(stderr, "usage: harness {corpus} {regex}\n");
+        return 1;
+    }
+    compile(argv[2]);
+#else
+    if (argc != 2) {
+        fprintf(stderr, "usage: harness {corpus}\n");
+        return 1;
+    }
+#endif
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    // lines are NUL terminated in place of the '\n', which regexec needs
+    unsigned char *data = malloc(size + 1);
+    if (fread(data, 1, size, file) != size) {
+        perror(argv[1]);
+        return 1;
+    }
+    fclose(file);
+    data[size] = '\0';
+
+    size_t lines = 0;
+    for (size_t i = 0; i < size; ++i) {
+        lines += data[i] == '\n';
+    }
+    unsigned char **starts = malloc((lines + 1) * sizeof(unsigned char *));
+    size_t *lens = malloc((lines + 1) * sizeof(size_t));
+    lines = 0;
+    for (size_t i = 0, begin = 0; i < size; ++i) {
+        if (data[i] == '\n') {
+            data[i] = '\0';
+            starts[lines] = data + begin;
+            lens[lines] = i - begin;
+            lines += 1;
+            begin = i + 1;
+        }
+    }
+
+    size_t matched = 0;
+    double best_search = 1e30, best_match = 1e30;
+    volatile ptrdiff_t sink = 0;
+    for (int r = 0; r < ROUNDS; ++r) {
+        size_t count = 0, s, e;
+        double t = now();
+        for (size_t i = 0; i < lines; ++i) {
+            count += search(starts[i], lens[i], &s, &e);
+        }
+        t = now() - t;
+        best_search = t < best_search ? t : best_search;
+        matched = count;
+
+        t = now();
+        for (size_t i = 0; i < lines; ++i) {
+            sink += match_n(starts[i], lens[i]);
+        }
+        t = now() - t;
+        best_match = t < best_match ? t : best_match;
+    }
+
+    printf("%zu\t%.1f\t%.1f\n", matched, size / best_search / 1e6, best_match * 1e9 / lines);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+# Builds the corpora, compiles every pattern of bench/patterns.tsv with
+# every backend at -O2 and times it against glibc regexec.
+#
+# Results go to stdout and target/bench/results.tsv, one row per pattern,
+# backend and corpus:
+#   pattern backend corpus lines_matched search_MBps match_ns c_bytes text_bytes
+# search_MBps is search() over every line of the corpus, match_ns is one
+# match_n() call per line. The sizes are the generated C and the .text of
+# its object file, "-" for regexec.
+#
+# BENCH_MB sets the size of each corpus in megabytes (default 8).
+# BENCH_PASSES lists -O settings that -b tree is also timed with, each as a
+# backend tree-O<setting> (default "none", against the default, which is
+# all but coalesce for -b tree), e.g.
+# BENCH_PASSES="none charset flatten prefix suffix coalesce".
+
+set -e
+
+cd "$(dirname "$0")/.."
+make
+mkdir -p target/bench
+cd target/bench
+
+mb="${BENCH_MB:-8}"
+tree_passes=""
+for passes in ${BENCH_PASSES-none}; do
+    tree_passes="$tree_passes tree-O$passes"
+done
+cc -O2 -o corpus ../../bench/corpus.c
+for kind in text log; do
+    if [ ! -f "$kind-$mb.txt" ]; then
+        ./corpus "$kind" "$mb" "$kind-$mb.txt"
+    fi
+done
+cc -O2 -DREGEXEC -o harness-regexec ../../bench/harness.c
+
+results=results.tsv
+printf 'pattern\tbackend\tcorpus\tlines_matched\tsearch_MBps\tmatch_ns\tc_bytes\ttext_bytes\n' | tee "$results"
+
+tab="$(printf '\t')"
+grep -v '^#' ../../bench/patterns.tsv | while IFS="$tab" read -r name regexp; do
+    [ -n "$name" ] || continue
+    for backend in auto dfa-direct dfa-table lazy tree $tree_passes regexec; do
+        case "$backend" in
+            auto) flags="-b auto" ;;
+            dfa-direct) flags="-b dfa -e direct" ;;
+            dfa-table) flags="-b dfa -e table" ;;
+            lazy) flags="-b lazy" ;;
+            tree) flags="-b tree" ;;
+            tree-O*) flags="-b tree -O ${backend#tree-O}" ;;
+        esac
+        if [ "$backend" = regexec ]; then
+            harness="./harness-regexec"
+            c_bytes=-
+            text_bytes=-
+        else
+            ../regex-to-c $flags -- "$regexp" > gen.c 2> /dev/null
+            cc -O2 -c gen.c -o gen.o
+            c_bytes=$(wc -c < gen.c)
+            text_bytes=$(size -A gen.o | awk '$1 == ".text" { print $2 }')
+            cc -O2 ../../bench/harness.c gen.o -o harness-gen
+            harness="./harness-gen"
+        fi
+        for kind in text log; do
+            if [ "$backend" = regexec ]; then
+                row=$($harness "$kind-$mb.txt" "$regexp")
+            else
+                row=$($harness "$kind-$mb.txt")
+            fi
+            printf '%s\t%s\t%s\t%s\t%s\t%s\n' "$name" "$backend" "$kind" "$row" "$c_bytes" "$text_bytes" | tee -a "$results"
+        done
+    done
+done
+rm -f gen.c gen.o harness-gen
@@ -0,0 +1,85 @@
+#!/bin/sh
+
+# Compares match_batch() against calling match_n() once per input on
+# millions of short URL-like strings, for the table driven DFA unless other
+# generator options are given.
+#
+# usage: scripts/bench-batch.sh [regex] [options]
+
+set -e
+
+cd "$(dirname "$0")/.."
+make
+cd target/
+
+regexp="${1:-https?://[a-z0-9.-]+(/[a-zA-Z0-9_./-]*)?}"
+options="${2:--e table}"
+name="$(mktemp batchXXX)"
+./regex-to-c $options -- "$regexp" > "$name".c
+
+cat << 'EOF' >> "$name".c
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define INPUTS 2000000
+#define ROUNDS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+    static const char *hosts[] = { "example.com", "cdn.example.net", "a.b.c.d", "localhost" };
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789/._-";
+    unsigned char **bufs = malloc(INPUTS * sizeof(unsigned char *));
+    size_t *lens = malloc(INPUTS * sizeof(size_t));
+    ptrdiff_t *serial = malloc(INPUTS * sizeof(ptrdiff_t));
+    ptrdiff_t *batch = malloc(INPUTS * sizeof(ptrdiff_t));
+    size_t total = 0;
+
+    srand(42);
+    for (size_t i = 0; i < INPUTS; ++i) {
+        char tmp[128];
+        int len = snprintf(tmp, 64, "%s://%s/", rand() % 2 ? "https" : "http", hosts[rand() % 4]);
+        int path = rand() % 48;
+        for (int j = 0; j < path; ++j)
+            tmp[len++] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        bufs[i] = malloc(len);
+        memcpy(bufs[i], tmp, len);
+        lens[i] = len;
+        total += len;
+    }
+
+    double best_serial = 1e9, best_batch = 1e9;
+    for (int r = 0; r < ROUNDS; ++r) {
+        double t = now();
+        for (size_t i = 0; i < INPUTS; ++i)
+            serial[i] = match_n(bufs[i], lens[i]);
+        t = now() - t;
+        best_serial = t < best_serial ? t : best_serial;
+
+        t = now();
+        match_batch((const unsigned char **)bufs, lens, INPUTS, batch);
+        t = now() - t;
+        best_batch = t < best_batch ? t : best_batch;
+    }
+
+    for (size_t i = 0; i < INPUTS; ++i) {
+        if (serial[i] != batch[i]) {
+            printf("mismatch at input %zu: %td != %td\n", i, serial[i], batch[i]);
+            return 1;
+        }
+    }
+    printf("%d inputs, %.1f bytes on average\n", INPUTS, (double)total / INPUTS);
+    printf("match_n loop: %6.1f ns/input %8.1f MB/s\n", best_serial * 1e9 / INPUTS, total / best_serial / 1e6);
+    printf("match_batch:  %6.1f ns/input %8.1f MB/s\n", best_batch * 1e9 / INPUTS, total / best_batch / 1e6);
+    return 0;
+}
+EOF
+
+gcc -O2 "$name".c -o "$name"
+./"$name"
+rm "$name" "$name".c
@@ -8,11 +8,15 @@ cd target/
 
 regexp=""
 str=""
+cc_flags=""
 bin="${1:-regex-to-c}"
+[ $# -gt 0 ] && shift
+# remaining arguments are passed through to the generator, e.g. `-b dfa`
+flags="$*"
 
 run_match() {
     name="$(mktemp finalXXX)"
-    ./"$bin" "$regexp" >> "$name".c
+    ./"$bin" $flags -- "$regexp" >> "$name".c
 
     cat << 'EOF' >> "$name".c
 #include <stdio.h>
@@ -31,6 +35,306 @@ gcc "$name".c -o "$name"
 rm "$name" "$name".c
 }
 
+run_match_n() {
+    name="$(mktemp finalXXX)"
+    ./"$bin" $flags -- "$regexp" >> "$name".c
+
+    cat << EOF >> "$name".c
+#include <stdio.h>
+
+int main(void) {
+    static const unsigned char buf[] = "$str";
+    printf("%td\n", match_n(buf, sizeof(buf) - 1));
+    return 0;
+}
+EOF
+
+gcc $cc_flags "$name".c -o "$name"
+./"$name"
+rm "$name" "$name".c
+}
+
+run_search() {
+    name="$(mktemp finalXXX)"
+    ./"$bin" $flags -- "$regexp" >> "$name".c
+
+    cat << EOF >> "$name".c
+#include <stdio.h>
+
+int main(void) {
+    static const unsigned char buf[] = "$str";
+    size_t start, end;
+    if (search(buf, sizeof(buf) - 1, &start, &end)) {
+        printf("%zu %zu\n", start, end);
+    } else {
+        printf("none\n");
+    }
+    return 0;
+}
+EOF
+
+gcc "$name".c -o "$name"
+./"$name"
+rm "$name" "$name".c
+}
+
+run_match_set() {
+    name="$(mktemp finalXXX)"
+    printf '%s\n' "$regexp" > "$name".txt
+    ./"$bin" $flags -f "$name".txt >> "$name".c
+
+    cat << EOF >> "$name".c
+#include <stdio.h>
+
+int main(void) {
+    static const unsigned char buf[] = "$str";
+    ptrdiff_t lengths[MATCH_SET_SIZE];
+    printf("%d:", match_set(buf, sizeof(buf) - 1, lengths));
+    for (int i = 0; i < MATCH_SET_SIZE; ++i)
+        printf(" %td", lengths[i]);
+    printf("\n");
+    return 0;
+}
+EOF
+
+gcc "$name".c -o "$name"
+./"$name"
+rm "$name" "$name".c "$name".txt
+}
+
+# generates every line of $regexp with --batch, then prints the exit status
+# and match_n() of the input for each output, with the number of its pattern
+run_match_batch_files() {
+    name="$(mktemp -d finalXXX)"
+    printf '%s\n' "$regexp" > "$name"/patterns.txt
+    status=0
+    ./"$bin" $flags --batch "$name"/patterns.txt -j 2 -o "$name" 2> /dev/null || status=$?
+
+    printf '%s' "$status"
+    for c in "$name"/[0-9]*.c; do
+        cat << EOF >> "$c"
+#include <stdio.h>
+
+int main(void) {
+    static const unsigned char buf[] = "$str";
+    printf(" $(basename "$c" .c | sed 's/^0*\(.\)/\1/'):%td", match_n(buf, sizeof(buf) - 1));
+    return 0;
+}
+EOF
+        gcc "$c" -o "${c%.c}"
+        ./"${c%.c}"
+    done
+    echo
+    rm -r "$name"
+}
+
+# "same" when --batch writes what a single run prints, else the backend it chose
+run_batch_single() {
+    name="$(mktemp -d finalXXX)"
+    printf '%s\n' "$regexp" > "$name"/patterns.txt
+    ./"$bin" $batch_flags --batch "$name"/patterns.txt -o "$name" 2> /dev/null
+    ./"$bin" $batch_flags -- "$regexp" > "$name"/single.c 2> /dev/null
+    if cmp -s "$name"/00000.c "$name"/single.c; then
+        echo same
+    else
+        sed -n 2p "$name"/00000.c
+    fi
+    rm -r "$name"
+}
+
+run_match_prefixed() {
+    name="$(mktemp -d finalXXX)"
+    printf '%s\n' "$regexp" > "$name"/patterns.txt
+    ./"$bin" $flags --batch "$name"/patterns.txt --prefix m -o "$name" 2> /dev/null
+
+    # every matcher in one translation unit
+    for c in "$name"/[0-9]*.c; do
+        echo "#include \"$(basename "$c")\"" >> "$name"/all.c
+    done
+    cat << EOF >> "$name"/all.c
+#include <stdio.h>
+
+int main(void) {
+    static const unsigned char buf[] = "$str";
+EOF
+    for c in "$name"/[0-9]*.c; do
+        echo "    printf(\" %td\", m$(basename "$c" .c)_match_n(buf, sizeof(buf) - 1));" >> "$name"/all.c
+    done
+    cat << 'EOF' >> "$name"/all.c
+    putchar('\n');
+    return 0;
+}
+EOF
+
+gcc -Wall -Werror "$name"/all.c -o "$name"/all
+./"$name"/all
+rm -r "$name"
+}
+
+run_match_feed() {
+    name="$(mktemp finalXXX)"
+    ./"$bin" $flags -- "$regexp" >> "$name".c
+
+    cat << EOF >> "$name".c
+#include <stdio.h>
+
+int main(void) {
+    static const unsigned char buf[] = "$str";
+    size_t len = sizeof(buf) - 1;
+    match_state_t st;
+    match_init(&st);
+    for (size_t i = 0; i < len; i += $chunk) {
+        if (!match_feed(&st, buf + i, len - i < $chunk ? len - i : $chunk))
+            break;
+    }
+    printf("%td\n", match_finish(&st));
+    return 0;
+}
+EOF
+
+gcc "$name".c -o "$name"
+./"$name"
+rm "$name" "$name".c
+}
+
+run_match_batch() {
+    name="$(mktemp finalXXX)"
+    ./"$bin" $flags -- "$regexp" >> "$name".c
+
+    cat << 'EOF' >> "$name".c
+#include <stdio.h>
+
+int main(int argc, char *argv[]) {
+    const unsigned char *bufs[64];
+    size_t lens[64];
+    ptrdiff_t out[64];
+    for (int i = 1; i < argc; ++i) {
+        bufs[i - 1] = (const unsigned char *)argv[i];
+        lens[i - 1] = strlen(argv[i]);
+    }
+    match_batch(bufs, lens, argc - 1, out);
+    for (int i = 0; i < argc - 1; ++i)
+        printf("%s%td", i ? " " : "", out[i]);
+    printf("\n");
+    return 0;
+}
+EOF
+
+gcc "$name".c -o "$name"
+./"$name" $str
+rm "$name" "$name".c
+}
+
+run_match_captures() {
+    name="$(mktemp finalXXX)"
+    ./"$bin" $flags -c -- "$regexp" >> "$name".c
+
+    cat << EOF >> "$name".c
+#include <stdio.h>
+
+int main(void) {
+    static const unsigned char buf[] = "$str";
+    size_t starts[MATCH_CAPTURES], ends[MATCH_CAPTURES];
+    ptrdiff_t len = match_captures(buf, sizeof(buf) - 1, starts, ends);
+    printf("%td", len);
+    for (int g = 0; len >= 0 && g < MATCH_CAPTURES; ++g) {
+        if (starts[g] == MATCH_NO_CAPTURE) {
+            printf(" -");
+        } else {
+            printf(" %zu-%zu", starts[g], ends[g]);
+        }
+    }
+    printf("\n");
+    return 0;
+}
+EOF
+
+gcc -Wall -Werror "$name".c -o "$name"
+./"$name"
+rm "$name" "$name".c
+}
+
+# compiles every pattern twice through r2c_compile(), the second time from
+# the cache, and prints match_n() of the input for both
+run_library() {
+    name="$(mktemp finalXXX)"
+    cat << EOF >> "$name".c
+#include <stdio.h>
+#include "r2c.h"
+
+int main(void) {
+    static const unsigned char buf[] = "$str";
+    for (int i = 0; i < 2; ++i) {
+        r2c_matcher *matcher = r2c_compile("$regexp", 0);
+        if (matcher == NULL) {
+            printf("%snull", i ? " " : "");
+            continue;
+        }
+        printf("%s%td", i ? " " : "", r2c_match_n(matcher, buf, sizeof(buf) - 1));
+        r2c_free(matcher);
+    }
+    printf("\n");
+    return 0;
+}
+EOF
+
+gcc -fsanitize=address -I../src "$name".c libr2c.a -ldl -o "$name"
+R2C_CACHE_DIR="$(pwd)/$name".cache ./"$name" 2> /dev/null
+rm -r "$name" "$name".c "$name".cache
+}
+
+# the matched lengths, then the calls and matches counted for the whole regex
+run_profile() {
+    name="$(mktemp finalXXX)"
+    ./"$bin" $flags -p -- "$regexp" >> "$name".c
+
+    cat << 'EOF' >> "$name".c
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i)
+        printf("%s%d", i > 1 ? " " : "", match(argv[i]));
+    printf(" |\n");
+    match_dump_stats(stdout);
+    return 0;
+}
+EOF
+
+gcc -Wall -Werror "$name".c -o "$name"
+# the whole regex is regexNNN emitted last, or match_n for the dfa backend
+./"$name" $str | awk 'NR == 1 { printf "%s", $0 } /^(regex|match_n)/ { row = $2 " " $3 } END { print " " row }'
+rm "$name" "$name".c
+}
+
+run_grep() {
+    name="$(mktemp finalXXX)"
+    ./"$bin" $flags -g -- "$regexp" > "$name".c
+    printf "$str" > "$name".txt
+
+    gcc -pthread "$name".c -o "$name"
+    ./"$name" "$name".txt | tr '\n' '|'
+    echo
+    rm "$name" "$name".c "$name".txt
+}
+
+# prints the node counts from --stats, and whether the output is unchanged
+# and as long as the reported emitted_bytes
+run_stats_json() {
+    name="$(mktemp finalXXX)"
+    ./"$bin" $flags -- "$regexp" > "$name".c 2> /dev/null
+    ./"$bin" $flags --stats -- "$regexp" > "$name".stats.c 2> "$name".json
+
+    for node in regex branch piece atom; do
+        printf '%s ' "$(sed -n "s/.*\"${node}_nodes\": \([0-9]*\).*/\1/p" "$name".json)"
+    done
+    bytes="$(sed -n 's/^  "emitted_bytes": \([0-9]*\).*/\1/p' "$name".json)"
+    if cmp -s "$name".c "$name".stats.c && [ "$bytes" -eq "$(wc -c < "$name".c)" ]; then
+        echo same
+    else
+        echo different
+    fi
+    rm "$name" "$name".c "$name".stats.c "$name".json
+}
+
 success=0
 failure=0
 
@@ -39,24 +343,315 @@ run() {
     str="$2"
     expected="$3"
     result=$(run_match "$regexp" "$str")
+    check
+}
+
+# run_bt {regex} {str} {expected}, for matches that take backtracking:
+# -b tree keeps the longest match of each node and never goes back
+run_bt() {
+    case "$flags" in
+        *tree*) return ;;
+    esac
+    run "$@"
+}
+
+check() {
     if [ "$result" = "$expected" ]; then
         success=$((success + 1))
     else
         failure=$((failure + 1))
-        echo "FAIL: regex{$regexp} str{$str} expected{$expected} result{$result}"
+        printf '%s\n' "FAIL: regex{$regexp} str{$str} expected{$expected} result{$result}"
     fi
 }
 
+# run_n {regex} {C string literal} {expected length}, through match_n()
+run_n() {
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_match_n)
+    check
+}
+
+# run_flush {regex} {C string literal} {expected length}, through match_n()
+# with a lazy DFA cache of two states, so that it is flushed all the time
+run_flush() {
+    case "$flags" in
+        *lazy*) ;;
+        *) return ;;
+    esac
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    cc_flags="-DR2C_LAZY_CACHE_STATES=2"
+    result=$(run_match_n)
+    cc_flags=""
+    check
+}
+
+# run_c {regex} {C string literal} {expected "length start-end..." for every group}, through match_captures()
+run_c() {
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_match_captures)
+    check
+}
+
+# run_s {regex} {C string literal} {expected "start end" or "none"}, through search()
+run_s() {
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_search)
+    check
+}
+
+# run_set {patterns, one per line} {C string literal} {expected "count: lengths..."}, through match_set()
+run_set() {
+    case "$flags" in
+        *tree*|*lazy*) return ;;  # pattern sets need the dfa backend
+    esac
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_match_set)
+    check
+}
+
+# run_batch {patterns, one per line} {C string literal} {expected "status N:length..."}, through --batch
+run_batch() {
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_match_batch_files)
+    check
+}
+
+# run_batch_same {regex} {options}: --batch generates the same code as a
+# single run with these options
+run_batch_same() {
+    regexp="$1"
+    batch_flags="$2"
+    expected="same"
+    result=$(run_batch_single)
+    check
+}
+
+# run_prefix {patterns, one per line} {C string literal} {expected lengths}, through
+# --batch --prefix, with all of them included into one file
+run_prefix() {
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_match_prefixed | sed 's/^ //')
+    check
+}
+
+# run_feed {regex} {C string literal} {chunk size} {expected length}, through match_feed()
+run_feed() {
+    case "$flags" in
+        *tree*|*lazy*) return ;;  # streaming needs the dfa backend
+    esac
+    regexp="$1"
+    str="$2"
+    chunk="$3"
+    expected="$4"
+    result=$(run_match_feed)
+    check
+}
+
+# run_b {regex} {space separated inputs} {expected lengths}, through match_batch()
+run_b() {
+    case "$flags" in
+        *tree*|*lazy*) return ;;  # batches need the dfa backend
+    esac
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_match_batch)
+    check
+}
+
+# run_l {regex} {C string literal} {expected "length length"}, through libr2c.a;
+# the library picks its own backend, so this only runs once
+run_l() {
+    case "$flags" in
+        *auto*) ;;
+        *) return ;;
+    esac
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_library)
+    check
+}
+
+# run_p {regex} {space separated inputs} {expected "lengths | calls matched"}, with -p
+run_p() {
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_profile)
+    check
+}
+
+# run_g {regex} {printf format of the file} {expected lines joined by |}, through the -g main()
+run_g() {
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result=$(run_grep)
+    check
+}
+
+# run_stats {regex} {expected "regex branch piece atom" node counts}, through --stats
+run_stats() {
+    regexp="$1"
+    str=""
+    expected="$2 same"
+    result=$(run_stats_json)
+    check
+}
+
+# run_opt {regex} {expected "charset flatten prefix suffix coalesce" rewrites}, through
+# --stats with -O all
+# run_default {regex} {C string literal} {expected "length trie_nodes"}, through
+# match_n() without any generator options, once, in the -b auto run
+run_default() {
+    case "$flags" in
+        *auto*) ;;
+        *) return ;;
+    esac
+    run_flags="$flags"
+    flags=""
+    regexp="$1"
+    str="$2"
+    expected="$3"
+    result="$(run_match_n) $(./"$bin" --stats -- "$regexp" 2>&1 > /dev/null \
+        | sed -n 's/.*"trie_nodes": \([0-9]*\).*/\1/p')"
+    flags="$run_flags"
+    check
+}
+
+run_opt() {
+    regexp="$1"
+    expected="$2"
+    result=$(./"$bin" $flags -O all --stats -- "$regexp" 2>&1 > /dev/null \
+        | sed -n 's/.*"optimize_[a-z]*": \([0-9]*\).*/\1/p' | tr '\n' ' ' | sed 's/ $//')
+    check
+}
+
 # run {regex} {str} {expected}
 run 'a' 'a' 'a'
 run 'abcdefg' 'abcdefg' 'abcdefg'
 run '[a-z]*' 'abcdefg' 'abcdefg'
 run '(ab|cd)*' 'abcdcdabefg' 'abcdcdab'
-run 'a*ax' 'ax' 'ax'
+run_bt 'a*ax' 'ax' 'ax'
 run 'a+|aab*' 'aab' 'aab'
 run 'ab*c' 'ac' 'ac'
 run 'x(ab)*y' '' ''
+run_bt '(a|ab)(c|bcd)' 'abcd' 'abcd'
+run 'x{2,3}' 'xxxx' 'xxx'
+run '(ne.er|gon+a|giv*|you(up))' 'gonnnaa' 'gonnna'
+run 'x[0-9a-f]{4,8}y' 'xab12cy' 'xab12cy'
+run '[ab]{5}c' 'ababc' ''
+run 'ne.er|never' 'never' 'never'
+run_bt 'a{1,2}a{1,2}' 'aa' 'aa'
+# coalesce would let .+.. take all of acbc on -b tree
+run '(.+..|)ac' 'acbc' 'ac'
+run 'xa|ya|xb' 'yab' 'ya'
+run 'abc|abd|ab' 'abx' 'ab'
+run 'if|in|int|for|foo|while|do|done|else' 'integer' 'int'
+run 'x(if|in|int|for|foo|while|do|done|else)y' 'xdoney' 'xdoney'
+run '(ab|cd|[ef]g|hi|jk|lm|no|pq)r|s' 'fgr' 'fgr'
+run '([aeiou][aeiou]|[^aeiou ]\S)[aeiou]' 'b-ea' 'b-e'
+
+run_n 'a[^b]*b' 'a\0\0b\0' '4'
+run_n '[^x]+' 'ab\0x' '3'
+run_n 'ab\x00c' 'ab\0cd' '4'
+run_n 'abc' 'ab' '-1'
+run_n 'a{1,10000}b' 'aaab' '4'
+run_n '(.{4,6}|x)z' 'abcdefz' '7'
+# counting runs whose last state only takes part of the run's charset
+run_n '[a-c]{9}c' 'aaaaaaaaab' '-1'
+run_n 'a.{14}a' 'abbxccbccbbxbaaacabxx' '16'
+run_n '[ab][a-c]{12}c' 'aaaaaaaaaaaaab' '-1'
+# runs of a charset that takes no byte at all
+run_n '[^[:ascii:]]+' 'ab' '-1'
+run_n 'a[^[:ascii:]]*' 'a\x80x' '1'
+
+run_flush '(a|b)*a(a|b){3}' 'abbababbbx' '9'
+run_flush '(a|b)*a(a|b){3}' 'bbbbab' '-1'
+
+run_c '(a|ab)(c|bcd)(d*)' 'abcd' '4 0-4 0-1 1-4 4-4'
+run_c '(a*)(a*)' 'aaa' '3 0-3 0-3 3-3'
+run_c '(a|(b))*' 'bax' '2 0-2 1-2 0-1'
+run_c 'x(ab)*y' 'xy' '2 0-2 -'
+run_c '([0-9]+)-([0-9]+)' '12-345x' '6 0-6 0-2 3-6'
+run_c 'abc' 'abd' '-1'
+
+run_s 'abc' 'xxabcx' '2 5'
+run_s 'x[0-9]+px' 'x1 x23px' '3 8'
+run_s '[0-9]+px' 'w 12 34px' '5 9'
+run_s '(ne.er|gon+a)' 'we are gonna' '7 12'
+run_s 'a*' 'bbb' '0 0'
+run_s 'abc' 'ababx' 'none'
+run_s '[^[:ascii:]]' 'ab' 'none'
+
+run_feed 'ab[0-9]*c' 'ab1234567c' '3' '10'
+run_feed '(ab)*' 'ababa' '1' '4'
+run_feed 'abc' 'abd' '2' '-1'
+run_feed 'x[a-z]{6,9}' 'xabcdefghij' '2' '10'
+run_feed '[a-c]{9}c' 'aaaaaaaaab' '3' '-1'
+
+run_b '[a-z]+[0-9]*' 'abc ab12 9 x0 hello world12345 a ' '3 4 -1 2 5 10 1'
+run_b 'a(b|c)*d' 'abcbcbcbcbcbcbcbcbcd ad abx abbbbbbbbbbbbbbbbbbbbbbbbbbbbd x abd' '20 2 -1 30 -1 3'
+
+run_l '(ab)+c' 'ababcx' '5 5'
+run_l 'x[0-9]{1,3}' 'x12345' '4 4'
+run_l '[a' '' 'null null'
+
+run_g 'b[0-9]+' 'a1\nb12\n\nxb3y\nb' 'b12|xb3y|'
+run_g 'x[^z]*z' 'x\nz\nxaz\n' 'xaz|'
+
+run_stats '(ab|c)d*' '2 3 5 5'
+
+run_opt 'a|b|c' '2 0 0 0 0'
+run_opt '((x))' '0 2 0 0 0'
+run_opt 'abc|abd|ab' '1 0 2 0 0'
+run_opt 'xa|ya|za*' '1 1 0 1 0'
+run_opt 'a*a+b' '0 0 0 0 1'
+
+run_p '(ab|c)[0-9]*' 'ab12 c x' '4 1 -1 | 3 2'
+run_p 'x?' 'a x' '0 1 | 2 2'
+run_stats 'x((y)|z)' '3 4 5 5'
+
+# ten thousand keywords are far past 64 positions, and their DFA takes the
+# compiler minutes; -b auto gives them to the trie of -b tree
+keywords="($(awk 'BEGIN { for (i = 0; i < 10000; ++i) printf "%s%d|", substr("abcdefghij", i % 10 + 1, 3), i * 7919 % 100003 }')keyword)"
+run_default "$keywords" 'keywordz' '7 24831'
+
+run_set 'abc
+[0-9]+
+a[a-z]*
+ab' 'abcd' '3: 3 -1 4 2'
+run_set 'x
+y' 'z' '0: -1 -1'
+
+run_batch 'ab+
+[a
+a|abb*c
+(ab)*' 'abbc' '1 0:3 2:4 3:2'
+run_batch_same 'ab+c' "$flags"
+run_batch_same 'ab+c' '-e table'
+
+run_prefix 'ab+
+a|abb*c
+[a-c]*
+(ab)*' 'abbc' '3 4 4 2'
 
 echo "$success SUCCESS"
 echo "$failure FAILURE"
 echo "$(( 100 * success / (success + failure) ))% passed"
+[ "$failure" -eq 0 ]
@@ -0,0 +1,46 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "xutils.h"
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    max_align_t data[];
+};
+
+extern void arena_init(Arena *arena) {
+    arena->chunks = NULL;
+    arena->used = 0;
+    arena->capacity = 0;
+}
+
+extern void *arena_alloc(Arena *arena, size_t size) {
+    size_t align = sizeof(max_align_t);
+    size = (size + align - 1) / align * align;
+
+    if (arena->chunks == NULL || arena->used + size > arena->capacity) {
+        size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        ArenaChunk *chunk = xmalloc(sizeof(ArenaChunk) + capacity);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->used = 0;
+        arena->capacity = capacity;
+    }
+
+    void *result = (char *)arena->chunks->data + arena->used;
+    arena->used += size;
+    return result;
+}
+
+extern void arena_drop(Arena *arena) {
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(arena);
+}
@@ -0,0 +1,18 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+typedef struct ArenaChunk ArenaChunk;
+
+// Bump allocator: many small allocations, one arena_drop() frees them all.
+typedef struct {
+    ArenaChunk *chunks;
+    size_t used, capacity;  // of the newest chunk
+} Arena;
+
+extern void arena_init(Arena *arena);
+extern void *arena_alloc(Arena *arena, size_t size);
+extern void arena_drop(Arena *arena);
+
+#endif
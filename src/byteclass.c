@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "regtree.h"
+#include "byteclass.h"
+
+// split every class into the bytes inside and outside `allowed`
+static void refine(ByteClasses *classes, const Charset *allowed) {
+    int remap[256][2];
+    memset(remap, -1, sizeof(remap));
+
+    int size = 0;
+    for (int c = 0; c < 256; ++c) {
+        int *slot = &remap[classes->class_of[c]][charset_has(allowed, c)];
+        if (*slot == -1) {
+            *slot = size;
+            classes->representative[size] = c;
+            size += 1;
+        }
+        classes->class_of[c] = *slot;
+    }
+    classes->size = size;
+}
+
+static void refine_regex(ByteClasses *classes, RegexNode *regex) {
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        for (int j = 0; j < branch->size; ++j) {
+            AtomNode *atom = branch->pieces[j]->atom;
+            if (atom->is_simple_atom) {
+                refine(classes, &atom->allowed);
+            } else {
+                refine_regex(classes, atom->regex);
+            }
+        }
+    }
+}
+
+extern void byteclasses_from_regtree(RegexNode *regex, ByteClasses *classes) {
+    byteclasses_from_regtrees(&regex, 1, classes);
+}
+
+extern void byteclasses_from_regtrees(RegexNode **regexes, int count, ByteClasses *classes) {
+    classes->size = 1;
+    memset(classes->class_of, 0, sizeof(classes->class_of));
+    memset(classes->representative, 0, sizeof(classes->representative));
+    for (int i = 0; i < count; ++i) {
+        refine_regex(classes, regexes[i]);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef BYTECLASS_H_
+#define BYTECLASS_H_
+
+#include "regtree.h"
+
+// Bytes that no charset in the pattern tells apart share one class, so
+// automata only need one column per class instead of one per byte.
+typedef struct {
+    int size;
+    unsigned char class_of[256];
+    unsigned char representative[256];  // some byte of each class
+} ByteClasses;
+
+extern void byteclasses_from_regtree(RegexNode *regex, ByteClasses *classes);
+extern void byteclasses_from_regtrees(RegexNode **regexes, int count, ByteClasses *classes);
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "xutils.h"
+#include "regtree.h"
+#include "nfa.h"
+#include "nfa-table.h"
+#include "byteclass.h"
+#include "stats.h"
+#include "captures.h"
+
+// Threads are kept in priority order: the left alternative before the
+// right one, one more repetition before leaving the loop. The overall match
+// is the longest one, like match_n(); of the ways to match that much, the
+// groups come from the one with the highest priority.
+static void emit_runtime(int group_count, FILE *out) {
+    fprintf(out, "\n\
+#define MATCH_CAPTURES %d\n\
+#define MATCH_NO_CAPTURE ((size_t)-1)\n\
+#define CAP_SLOTS (2 * MATCH_CAPTURES)\n\
+\n\
+// at most one thread per NFA state, each with its own slots\n\
+typedef struct {\n\
+    uint32_t size;\n\
+    uint32_t state[CAP_NFA_SIZE];\n\
+    size_t slots[CAP_NFA_SIZE][CAP_SLOTS];\n\
+} cap_list_t;\n\
+\n\
+typedef struct {\n\
+    cap_list_t list[2];\n\
+    size_t slots[CAP_SLOTS];    // the thread being followed by cap_add()\n\
+    size_t best[CAP_SLOTS];     // the slots of the longest match so far\n\
+    uint32_t stamp;\n\
+    uint32_t mark[CAP_NFA_SIZE];\n\
+    // a state to follow, or a slot to restore when `slot` is not -1\n\
+    struct {\n\
+        uint32_t state;\n\
+        int32_t slot;\n\
+        size_t value;\n\
+    } stack[CAP_NFA_SIZE + 1];\n\
+} cap_vm_t;\n\
+\n\
+static _Thread_local cap_vm_t *cap_vm;\n\
+\n\
+static cap_vm_t *cap_vm_get(void) {\n\
+    if (cap_vm == NULL) {\n\
+        cap_vm = malloc(sizeof(cap_vm_t));\n\
+        if (cap_vm == NULL) {\n\
+            abort();\n\
+        }\n\
+        cap_vm->stamp = 0;\n\
+        memset(cap_vm->mark, 0, sizeof(cap_vm->mark));\n\
+    }\n\
+    return cap_vm;\n\
+}\n\
+\n\
+void match_captures_free(void) {\n\
+    free(cap_vm);\n\
+    cap_vm = NULL;\n\
+}\n\
+\n\
+static void cap_new_stamp(cap_vm_t *vm) {\n\
+    if (++vm->stamp == 0) {\n\
+        memset(vm->mark, 0, sizeof(vm->mark));\n\
+        vm->stamp = 1;\n\
+    }\n\
+}\n\
+\n\
+// adds the threads reachable from `s` without reading a byte, with the\n\
+// slots in vm->slots; states already added for this position are skipped,\n\
+// since whoever got there first has the higher priority\n\
+static void cap_add(cap_vm_t *vm, cap_list_t *l, uint32_t s, size_t pos) {\n\
+    uint32_t top = 0;\n\
+    vm->stack[top].state = s;\n\
+    vm->stack[top++].slot = -1;\n\
+    while (top > 0) {\n\
+        top -= 1;\n\
+        if (vm->stack[top].slot != -1) {\n\
+            vm->slots[vm->stack[top].slot] = vm->stack[top].value;\n\
+            continue;\n\
+        }\n\
+        s = vm->stack[top].state;\n\
+        while (s != CAP_NONE && vm->mark[s] != vm->stamp) {\n\
+            const CAP_ROW_TYPE *row = cap_nfa[s];\n\
+            vm->mark[s] = vm->stamp;\n\
+            if (row[0] == CAP_SPLIT) {\n\
+                vm->stack[top].state = row[2];\n\
+                vm->stack[top++].slot = -1;\n\
+                s = row[1];\n\
+            } else if (row[0] == CAP_SAVE) {\n\
+                vm->stack[top].slot = row[2];\n\
+                vm->stack[top++].value = vm->slots[row[2]];\n\
+                vm->slots[row[2]] = pos;\n\
+                s = row[1];\n\
+            } else {\n\
+                l->state[l->size] = s;\n\
+                memcpy(l->slots[l->size++], vm->slots, sizeof(vm->slots));\n\
+                break;\n\
+            }\n\
+        }\n\
+    }\n\
+}\n\
+\n\
+// the length of the longest match at the start of buf, or -1; on a match\n\
+// group g spans [starts[g], ends[g]), or both are MATCH_NO_CAPTURE when\n\
+// the group took no part in it; group 0 is the whole match\n\
+ptrdiff_t match_captures(const unsigned char *buf, size_t len, size_t *starts, size_t *ends) {\n\
+    cap_vm_t *vm = cap_vm_get();\n\
+    cap_list_t *now = &vm->list[0], *next = &vm->list[1];\n\
+    ptrdiff_t last = -1;\n\
+\n\
+    for (int k = 0; k < CAP_SLOTS; ++k) {\n\
+        vm->slots[k] = MATCH_NO_CAPTURE;\n\
+    }\n\
+    now->size = 0;\n\
+    cap_new_stamp(vm);\n\
+    cap_add(vm, now, 0, 0);\n\
+    for (size_t i = 0; now->size > 0; ++i) {\n\
+        for (uint32_t t = 0; t < now->size; ++t) {\n\
+            if (cap_nfa[now->state[t]][0] == CAP_MATCH) {\n\
+                last = i;\n\
+                memcpy(vm->best, now->slots[t], sizeof(vm->best));\n\
+                break;\n\
+            }\n\
+        }\n\
+        if (i == len) {\n\
+            break;\n\
+        }\n\
+\n\
+        unsigned cls = cap_byte_class[buf[i]];\n\
+        next->size = 0;\n\
+        cap_new_stamp(vm);\n\
+        for (uint32_t t = 0; t < now->size; ++t) {\n\
+            const CAP_ROW_TYPE *row = cap_nfa[now->state[t]];\n\
+            if (row[0] == CAP_CHARSET && (cap_class_set[row[2]][cls >> 5] >> (cls & 31) & 1)) {\n\
+                memcpy(vm->slots, now->slots[t], sizeof(vm->slots));\n\
+                cap_add(vm, next, row[1], i + 1);\n\
+            }\n\
+        }\n\
+        cap_list_t *swap = now;\n\
+        now = next;\n\
+        next = swap;\n\
+    }\n\
+\n\
+    if (last != -1) {\n\
+        for (int g = 0; g < MATCH_CAPTURES; ++g) {\n\
+            starts[g] = vm->best[2 * g];\n\
+            ends[g] = vm->best[2 * g + 1];\n\
+        }\n\
+    }\n\
+    return last;\n\
+}\n", group_count);
+}
+
+extern void emit_captures(RegexNode *regex, FILE *out) {
+    stats_begin("captures");
+    ByteClasses classes;
+    byteclasses_from_regtree(regex, &classes);
+    Nfa *nfa = nfa_from_regtree_tagged(regex);
+    NfaTable table;
+    nfa_table_from_nfa(nfa, &table);
+    stats_add("capture_groups", nfa->group_count - 1);
+
+    fprintf(out, "\n\
+// match_captures(): %d groups, %d tagged NFA states\n\
+#include <stddef.h>\n\
+#include <stdint.h>\n\
+#include <stdlib.h>\n\
+#include <string.h>\n", nfa->group_count - 1, table.size);
+    emit_nfa_table(nfa, &table, &classes, "cap", out);
+    emit_runtime(nfa->group_count, out);
+    stats_end();
+
+    nfa_table_drop(&table);
+    nfa_drop(nfa);
+}
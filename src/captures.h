@@ -0,0 +1,15 @@
+#ifndef CAPTURES_H_
+#define CAPTURES_H_
+
+#include <stdio.h>
+
+#include "regtree.h"
+
+// Emits match_captures(), which matches like match_n() and also reports
+// where every parenthesized group matched. It walks a tagged NFA once over
+// the input (a Pike VM): every thread carries the positions its groups
+// started and ended at, and of two threads that reach the same state only
+// the one with the higher priority is kept, so there is no backtracking.
+extern void emit_captures(RegexNode *regex, FILE *out);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef CHARSET_H_
+#define CHARSET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// a set of bytes, one bit per byte
+typedef struct {
+    uint8_t bits[32];
+} Charset;
+
+static inline bool charset_has(const Charset *set, int c) {
+    return (set->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static inline void charset_put(Charset *set, int c, bool value) {
+    if (value) {
+        set->bits[c >> 3] |= (uint8_t)(1u << (c & 7));
+    } else {
+        set->bits[c >> 3] &= (uint8_t)~(1u << (c & 7));
+    }
+}
+
+#endif
@@ -0,0 +1,489 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "xutils.h"
+#include "nfa.h"
+#include "dfa.h"
+
+// Subset construction. A DFA state is identified by the sorted set of NFA
+// states it stands for; only NS_CHARSET and NS_MATCH states are kept in the
+// set, since the epsilon-only NS_SPLIT states do not affect behaviour.
+typedef struct {
+    Nfa *nfa;
+    Dfa *dfa;
+    int dfa_capacity;
+
+    // sets of all DFA states, packed one after another
+    int *pool;
+    int pool_size, pool_capacity;
+    int *set_offset, *set_len;
+    int accepts_capacity;
+
+    // open addressing: set hash -> DFA state id, -1 for empty slots
+    int *slots;
+    int slot_capacity;
+
+    // scratch space for epsilon closures
+    int *stack;
+    int *mark;
+    int stamp;
+    int *closure;
+    int closure_len;
+} Builder;
+
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t hash_set(const int *set, int len) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; ++i) {
+        hash ^= (uint32_t)set[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void compute_closure(Builder *b, const int *seeds, int seed_len) {
+    NfaState *states = b->nfa->states;
+    int top = 0;
+
+    b->stamp += 1;
+    b->closure_len = 0;
+    for (int i = 0; i < seed_len; ++i) {
+        if (b->mark[seeds[i]] != b->stamp) {
+            b->mark[seeds[i]] = b->stamp;
+            b->stack[top++] = seeds[i];
+        }
+    }
+
+    while (top > 0) {
+        int s = b->stack[--top];
+        if (states[s].type == NS_SPLIT) {
+            for (int i = 0; i < 2; ++i) {
+                int t = states[s].out[i];
+                if (t != -1 && b->mark[t] != b->stamp) {
+                    b->mark[t] = b->stamp;
+                    b->stack[top++] = t;
+                }
+            }
+        } else {
+            b->closure[b->closure_len++] = s;
+        }
+    }
+
+    qsort(b->closure, b->closure_len, sizeof(int), cmp_int);
+}
+
+static bool same_set(Builder *b, int id, const int *set, int len) {
+    return b->set_len[id] == len
+        && memcmp(b->pool + b->set_offset[id], set, len * sizeof(int)) == 0;
+}
+
+static void rehash(Builder *b) {
+    int capacity = b->slot_capacity ? b->slot_capacity * 2 : 256;
+    int *slots = xmalloc(capacity * sizeof(int));
+    for (int i = 0; i < capacity; ++i)
+        slots[i] = -1;
+
+    for (int id = 0; id < b->dfa->size; ++id) {
+        uint32_t h = hash_set(b->pool + b->set_offset[id], b->set_len[id]);
+        int i = h & (capacity - 1);
+        while (slots[i] != -1)
+            i = (i + 1) & (capacity - 1);
+        slots[i] = id;
+    }
+
+    free(b->slots);
+    b->slots = slots;
+    b->slot_capacity = capacity;
+}
+
+static int add_dfa_state(Builder *b, const int *set, int len) {
+    Dfa *dfa = b->dfa;
+    if (dfa->size == b->dfa_capacity) {
+        b->dfa_capacity = b->dfa_capacity ? b->dfa_capacity * 2 : 64;
+        dfa->transitions = xrealloc(dfa->transitions,
+                b->dfa_capacity * dfa->classes.size * sizeof(int));
+        dfa->accepting = xrealloc(dfa->accepting, b->dfa_capacity * sizeof(bool));
+        dfa->accept_offset = xrealloc(dfa->accept_offset, (b->dfa_capacity + 1) * sizeof(int));
+        b->set_offset = xrealloc(b->set_offset, b->dfa_capacity * sizeof(int));
+        b->set_len = xrealloc(b->set_len, b->dfa_capacity * sizeof(int));
+    }
+    while (b->pool_size + len > b->pool_capacity) {
+        b->pool_capacity = b->pool_capacity ? b->pool_capacity * 2 : 1024;
+        b->pool = xrealloc(b->pool, b->pool_capacity * sizeof(int));
+    }
+
+    int id = dfa->size++;
+    memcpy(b->pool + b->pool_size, set, len * sizeof(int));
+    b->set_offset[id] = b->pool_size;
+    b->set_len[id] = len;
+    b->pool_size += len;
+
+    int *accepts_end = &dfa->accept_offset[id + 1];
+    *accepts_end = dfa->accept_offset[id];
+    for (int i = 0; i < len; ++i) {
+        NfaState *state = &b->nfa->states[set[i]];
+        if (state->type == NS_MATCH) {
+            if (*accepts_end == b->accepts_capacity) {
+                b->accepts_capacity = b->accepts_capacity ? b->accepts_capacity * 2 : 64;
+                dfa->accepts = xrealloc(dfa->accepts, b->accepts_capacity * sizeof(int));
+            }
+            dfa->accepts[(*accepts_end)++] = state->pattern;
+        }
+    }
+    int accept_len = *accepts_end - dfa->accept_offset[id];
+    qsort(dfa->accepts + dfa->accept_offset[id], accept_len, sizeof(int), cmp_int);
+    dfa->accepting[id] = accept_len > 0;
+
+    return id;
+}
+
+// returns the DFA state for the current closure, creating it if needed
+static int intern_closure(Builder *b) {
+    if (b->closure_len == 0) {
+        return -1;
+    }
+
+    if (2 * (b->dfa->size + 1) > b->slot_capacity) {
+        rehash(b);
+    }
+
+    uint32_t h = hash_set(b->closure, b->closure_len);
+    int i = h & (b->slot_capacity - 1);
+    while (b->slots[i] != -1) {
+        if (same_set(b, b->slots[i], b->closure, b->closure_len)) {
+            return b->slots[i];
+        }
+        i = (i + 1) & (b->slot_capacity - 1);
+    }
+
+    int id = add_dfa_state(b, b->closure, b->closure_len);
+    b->slots[i] = id;
+    return id;
+}
+
+extern Dfa *dfa_from_nfa(Nfa *nfa, const ByteClasses *classes) {
+    Builder b;
+    memset(&b, 0, sizeof(b));
+    b.nfa = nfa;
+    b.dfa = xmalloc(sizeof(Dfa));
+    memset(b.dfa, 0, sizeof(Dfa));
+    b.dfa->classes = *classes;
+    b.dfa->pattern_count = nfa->pattern_count;
+    b.dfa->accept_offset = xmalloc(sizeof(int));
+    b.dfa->accept_offset[0] = 0;
+    int k = classes->size;
+    b.stack = xmalloc(nfa->size * sizeof(int));
+    b.mark = xmalloc(nfa->size * sizeof(int));
+    memset(b.mark, 0, nfa->size * sizeof(int));
+    b.closure = xmalloc(nfa->size * sizeof(int));
+
+    compute_closure(&b, &nfa->start, 1);
+    b.dfa->start = intern_closure(&b);
+
+    int *seeds = xmalloc(nfa->size * sizeof(int));
+    int *last_seeds = xmalloc(nfa->size * sizeof(int));
+
+    // b.dfa->size grows while we walk, which makes this a BFS worklist
+    for (int id = 0; id < b.dfa->size; ++id) {
+        int last_len = -1, last_target = -1;
+
+        for (int cls = 0; cls < k; ++cls) {
+            int c = classes->representative[cls];
+            const int *set = b.pool + b.set_offset[id];
+            int len = b.set_len[id];
+            int seed_len = 0;
+
+            for (int i = 0; i < len; ++i) {
+                NfaState *state = &nfa->states[set[i]];
+                if (state->type == NS_CHARSET && charset_has(&nfa->charsets[state->charset], c)) {
+                    seeds[seed_len++] = state->out[0];
+                }
+            }
+
+            // neighbouring classes often lead to the same set
+            int target;
+            if (seed_len == last_len && memcmp(seeds, last_seeds, seed_len * sizeof(int)) == 0) {
+                target = last_target;
+            } else {
+                compute_closure(&b, seeds, seed_len);
+                target = intern_closure(&b);
+                memcpy(last_seeds, seeds, seed_len * sizeof(int));
+                last_len = seed_len;
+                last_target = target;
+            }
+
+            b.dfa->transitions[id * k + cls] = target;
+        }
+    }
+
+    free(seeds);
+    free(last_seeds);
+    free(b.pool);
+    free(b.set_offset);
+    free(b.set_len);
+    free(b.slots);
+    free(b.stack);
+    free(b.mark);
+    free(b.closure);
+
+    return b.dfa;
+}
+
+// Hopcroft's partition refinement. The DFA is completed with an explicit
+// dead state first; every state that ends up in the dead state's block can
+// never accept and is dropped again, so the result stays trimmed.
+typedef struct {
+    int *elems;         // states grouped by block
+    int *loc;           // position of each state in `elems`
+    int *block_of;
+    int *first, *end;   // [first, end) of each block in `elems`
+    int *marked;        // number of marked states at the front of a block
+    bool *in_work;
+    int size;
+} Partition;
+
+static void partition_mark(Partition *p, int s, int *touched, int *touched_len) {
+    int b = p->block_of[s];
+    int i = p->loc[s];
+    int j = p->first[b] + p->marked[b];
+    if (i < j) {
+        return; // already marked
+    }
+
+    int other = p->elems[j];
+    p->elems[j] = s;
+    p->loc[s] = j;
+    p->elems[i] = other;
+    p->loc[other] = i;
+
+    if (p->marked[b]++ == 0) {
+        touched[(*touched_len)++] = b;
+    }
+}
+
+// the states of the initial partition, ordered so that states accepting the
+// same patterns are next to each other
+typedef struct {
+    int state;
+    const int *accepts;
+    int len;
+} AcceptKey;
+
+static int cmp_accept_key(const void *a, const void *b) {
+    const AcceptKey *x = a, *y = b;
+    for (int i = 0; i < x->len && i < y->len; ++i) {
+        if (x->accepts[i] != y->accepts[i]) {
+            return (x->accepts[i] > y->accepts[i]) - (x->accepts[i] < y->accepts[i]);
+        }
+    }
+    if (x->len != y->len) {
+        return (x->len > y->len) - (x->len < y->len);
+    }
+    return (x->state > y->state) - (x->state < y->state);
+}
+
+static bool same_accepts(const AcceptKey *x, const AcceptKey *y) {
+    return x->len == y->len && memcmp(x->accepts, y->accepts, x->len * sizeof(int)) == 0;
+}
+
+extern Dfa *dfa_minimize(Dfa *dfa) {
+    int n = dfa->size + 1;
+    int dead = dfa->size;
+    int k = dfa->classes.size;
+
+    // inverse transitions, grouped by (class, target)
+    int *inv_offset = xmalloc((k * n + 1) * sizeof(int));
+    int *inv = xmalloc(k * n * sizeof(int));
+    memset(inv_offset, 0, (k * n + 1) * sizeof(int));
+    for (int s = 0; s < n; ++s) {
+        for (int c = 0; c < k; ++c) {
+            int t = s == dead ? -1 : dfa->transitions[s * k + c];
+            inv_offset[c * n + (t == -1 ? dead : t) + 1] += 1;
+        }
+    }
+    for (int i = 0; i < k * n; ++i) {
+        inv_offset[i + 1] += inv_offset[i];
+    }
+    int *fill = xmalloc(k * n * sizeof(int));
+    memcpy(fill, inv_offset, k * n * sizeof(int));
+    for (int s = 0; s < n; ++s) {
+        for (int c = 0; c < k; ++c) {
+            int t = s == dead ? -1 : dfa->transitions[s * k + c];
+            inv[fill[c * n + (t == -1 ? dead : t)]++] = s;
+        }
+    }
+    free(fill);
+
+    Partition p;
+    p.elems = xmalloc(n * sizeof(int));
+    p.loc = xmalloc(n * sizeof(int));
+    p.block_of = xmalloc(n * sizeof(int));
+    p.first = xmalloc(n * sizeof(int));
+    p.end = xmalloc(n * sizeof(int));
+    p.marked = xmalloc(n * sizeof(int));
+    p.in_work = xmalloc(n * sizeof(bool));
+    p.size = 0;
+
+    int *work = xmalloc(n * sizeof(int));
+    int work_len = 0;
+
+    // initial partition: one block per set of accepted patterns, which for
+    // a single pattern is just accepting / non-accepting
+    AcceptKey *keys = xmalloc(n * sizeof(AcceptKey));
+    for (int s = 0; s < n; ++s) {
+        keys[s].state = s;
+        keys[s].accepts = s == dead ? NULL : dfa->accepts + dfa->accept_offset[s];
+        keys[s].len = s == dead ? 0 : dfa->accept_offset[s + 1] - dfa->accept_offset[s];
+    }
+    qsort(keys, n, sizeof(AcceptKey), cmp_accept_key);
+    for (int pos = 0; pos < n; ++pos) {
+        int s = keys[pos].state;
+        if (pos == 0 || !same_accepts(&keys[pos - 1], &keys[pos])) {
+            p.first[p.size] = pos;
+            p.marked[p.size] = 0;
+            p.in_work[p.size] = true;
+            work[work_len++] = p.size;
+            p.size += 1;
+        }
+        p.elems[pos] = s;
+        p.loc[s] = pos;
+        p.block_of[s] = p.size - 1;
+        p.end[p.size - 1] = pos + 1;
+    }
+    free(keys);
+
+    int *splitter = xmalloc(n * sizeof(int));
+    int *touched = xmalloc(n * sizeof(int));
+
+    while (work_len > 0) {
+        int sb = work[--work_len];
+        p.in_work[sb] = false;
+        int splitter_len = p.end[sb] - p.first[sb];
+        memcpy(splitter, p.elems + p.first[sb], splitter_len * sizeof(int));
+
+        for (int c = 0; c < k; ++c) {
+            int touched_len = 0;
+            for (int i = 0; i < splitter_len; ++i) {
+                int t = splitter[i];
+                for (int e = inv_offset[c * n + t]; e < inv_offset[c * n + t + 1]; ++e) {
+                    partition_mark(&p, inv[e], touched, &touched_len);
+                }
+            }
+
+            for (int i = 0; i < touched_len; ++i) {
+                int b = touched[i];
+                int mid = p.first[b] + p.marked[b];
+                p.marked[b] = 0;
+                if (mid == p.end[b]) {
+                    continue;
+                }
+
+                int nb = p.size++;
+                p.first[nb] = p.first[b];
+                p.end[nb] = mid;
+                p.marked[nb] = 0;
+                p.first[b] = mid;
+                for (int j = p.first[nb]; j < p.end[nb]; ++j) {
+                    p.block_of[p.elems[j]] = nb;
+                }
+
+                if (p.in_work[b]) {
+                    p.in_work[nb] = true;
+                    work[work_len++] = nb;
+                } else {
+                    int smaller = p.end[nb] - p.first[nb] <= p.end[b] - p.first[b] ? nb : b;
+                    p.in_work[smaller] = true;
+                    work[work_len++] = smaller;
+                }
+            }
+        }
+    }
+
+    // renumber the surviving blocks in BFS order from the start state
+    int dead_block = p.block_of[dead];
+    int *block_id = xmalloc(p.size * sizeof(int));
+    int *order = xmalloc(p.size * sizeof(int));
+    for (int b = 0; b < p.size; ++b) {
+        block_id[b] = -1;
+    }
+
+    Dfa *result = xmalloc(sizeof(Dfa));
+    result->size = 0;
+    result->classes = dfa->classes;
+    result->pattern_count = dfa->pattern_count;
+    int start_block = p.block_of[dfa->start];
+    if (start_block != dead_block) {
+        block_id[start_block] = result->size;
+        order[result->size++] = start_block;
+    }
+    for (int i = 0; i < result->size; ++i) {
+        int s = p.elems[p.first[order[i]]];
+        for (int c = 0; c < k; ++c) {
+            int t = dfa->transitions[s * k + c];
+            int tb = t == -1 ? dead_block : p.block_of[t];
+            if (tb != dead_block && block_id[tb] == -1) {
+                block_id[tb] = result->size;
+                order[result->size++] = tb;
+            }
+        }
+    }
+
+    // a pattern that can never match still needs a (non-accepting) start
+    int size = result->size ? result->size : 1;
+    result->start = 0;
+    result->transitions = xmalloc(size * k * sizeof(int));
+    result->accepting = xmalloc(size * sizeof(bool));
+    result->accept_offset = xmalloc((size + 1) * sizeof(int));
+    result->accepts = xmalloc((dfa->accept_offset[dfa->size] + 1) * sizeof(int));
+    for (int c = 0; c < k; ++c) {
+        result->transitions[c] = -1;
+    }
+    result->accepting[0] = false;
+    result->accept_offset[0] = 0;
+    result->accept_offset[1] = 0;
+
+    for (int i = 0; i < result->size; ++i) {
+        int s = p.elems[p.first[order[i]]];
+        int len = dfa->accept_offset[s + 1] - dfa->accept_offset[s];
+        result->accepting[i] = dfa->accepting[s];
+        result->accept_offset[i + 1] = result->accept_offset[i] + len;
+        memcpy(result->accepts + result->accept_offset[i],
+                dfa->accepts + dfa->accept_offset[s], len * sizeof(int));
+        for (int c = 0; c < k; ++c) {
+            int t = dfa->transitions[s * k + c];
+            int tb = t == -1 ? dead_block : p.block_of[t];
+            result->transitions[i * k + c] = tb == dead_block ? -1 : block_id[tb];
+        }
+    }
+    result->size = size;
+
+    free(block_id);
+    free(order);
+    free(splitter);
+    free(touched);
+    free(work);
+    free(p.elems);
+    free(p.loc);
+    free(p.block_of);
+    free(p.first);
+    free(p.end);
+    free(p.marked);
+    free(p.in_work);
+    free(inv);
+    free(inv_offset);
+
+    return result;
+}
+
+extern void dfa_drop(Dfa *dfa) {
+    free(dfa->transitions);
+    free(dfa->accepting);
+    free(dfa->accept_offset);
+    free(dfa->accepts);
+    free(dfa);
+}
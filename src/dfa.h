@@ -0,0 +1,28 @@
+#ifndef DFA_H_
+#define DFA_H_
+
+#include <stdbool.h>
+
+#include "nfa.h"
+#include "byteclass.h"
+
+typedef struct {
+    int size;
+    int start;
+    ByteClasses classes;
+    // transitions[state * classes.size + class], -1 for the dead state
+    int *transitions;
+    bool *accepting;
+
+    // the patterns accepted in state i are
+    // accepts[accept_offset[i] .. accept_offset[i + 1]), in ascending order
+    int pattern_count;
+    int *accept_offset;
+    int *accepts;
+} Dfa;
+
+extern Dfa *dfa_from_nfa(Nfa *nfa, const ByteClasses *classes);
+extern Dfa *dfa_minimize(Dfa *dfa);
+extern void dfa_drop(Dfa *dfa);
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+
+#include "charset.h"
+#include "regtree.h"
+#include "grep.h"
+
+extern void grep_prepare(RegexNode *regex) {
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        for (int j = 0; j < branch->size; ++j) {
+            AtomNode *atom = branch->pieces[j]->atom;
+            if (atom->is_simple_atom) {
+                charset_put(&atom->allowed, '\n', false);
+            } else {
+                grep_prepare(atom->regex);
+            }
+        }
+    }
+}
+
+// The file is mmapped and cut into line aligned chunks, which a pool of
+// threads scans with search(). A match never spans a line, so every hit
+// gives one matching line and the scan goes on after it. The main thread
+// prints the chunks in file order as soon as each one is done.
+extern void emit_grep_main(FILE *out) {
+    fputs("\n\
+#include <fcntl.h>\n\
+#include <pthread.h>\n\
+#include <stdatomic.h>\n\
+#include <stdio.h>\n\
+#include <stdlib.h>\n\
+#include <sys/mman.h>\n\
+#include <sys/stat.h>\n\
+#include <unistd.h>\n\
+\n\
+#define GREP_CHUNK ((size_t)4 << 20)\n\
+\n\
+typedef struct {\n\
+    const unsigned char *start, *end;\n\
+    const unsigned char **lines;    // [lines[2i], lines[2i + 1]) is a matching line\n\
+    size_t count, capacity;\n\
+    int done;\n\
+} grep_chunk_t;\n\
+\n\
+typedef struct {\n\
+    grep_chunk_t *chunks;\n\
+    size_t chunk_count;\n\
+    atomic_size_t next;\n\
+    int count_only;\n\
+    pthread_mutex_t lock;\n\
+    pthread_cond_t cond;\n\
+} grep_job_t;\n\
+\n\
+static void grep_scan(grep_chunk_t *chunk, int count_only) {\n\
+    const unsigned char *p = chunk->start, *end = chunk->end;\n\
+    size_t s, e;\n\
+    while (p < end && search(p, end - p, &s, &e)) {\n\
+        const unsigned char *line = p + s;\n\
+        while (line > p && line[-1] != '\\n') {\n\
+            line -= 1;\n\
+        }\n\
+        const unsigned char *eol = memchr(p + s, '\\n', end - (p + s));\n\
+        eol = eol != NULL ? eol + 1 : end;\n\
+        if (!count_only) {\n\
+            if (chunk->count == chunk->capacity) {\n\
+                chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 64;\n\
+                chunk->lines = realloc(chunk->lines, 2 * chunk->capacity * sizeof(*chunk->lines));\n\
+                if (chunk->lines == NULL) {\n\
+                    perror(\"realloc\");\n\
+                    exit(2);\n\
+                }\n\
+            }\n\
+            chunk->lines[2 * chunk->count] = line;\n\
+            chunk->lines[2 * chunk->count + 1] = eol;\n\
+        }\n\
+        chunk->count += 1;\n\
+        p = eol;\n\
+    }\n\
+}\n\
+\n\
+static void *grep_worker(void *arg) {\n\
+    grep_job_t *job = arg;\n\
+    for (;;) {\n\
+        size_t i = atomic_fetch_add(&job->next, 1);\n\
+        if (i >= job->chunk_count) {\n\
+            return NULL;\n\
+        }\n\
+        grep_scan(&job->chunks[i], job->count_only);\n\
+        pthread_mutex_lock(&job->lock);\n\
+        job->chunks[i].done = 1;\n\
+        pthread_cond_broadcast(&job->cond);\n\
+        pthread_mutex_unlock(&job->lock);\n\
+    }\n\
+}\n\
+\n\
+// returns the number of matching lines, or -1 if the file can't be read\n\
+static long long grep_file(const char *path, int count_only, int threads, int show_name) {\n\
+    int fd = open(path, O_RDONLY);\n\
+    struct stat st;\n\
+    if (fd < 0 || fstat(fd, &st) < 0) {\n\
+        perror(path);\n\
+        if (fd >= 0) {\n\
+            close(fd);\n\
+        }\n\
+        return -1;\n\
+    }\n\
+    size_t size = st.st_size;\n\
+    const unsigned char *data = NULL;\n\
+    if (size > 0) {\n\
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);\n\
+        if (data == MAP_FAILED) {\n\
+            perror(path);\n\
+            close(fd);\n\
+            return -1;\n\
+        }\n\
+        posix_madvise((void *)data, size, POSIX_MADV_SEQUENTIAL);\n\
+    }\n\
+\n\
+    grep_job_t job;\n\
+    job.chunks = malloc((size / GREP_CHUNK + 1) * sizeof(grep_chunk_t));\n\
+    job.chunk_count = 0;\n\
+    atomic_init(&job.next, 0);\n\
+    job.count_only = count_only;\n\
+    pthread_mutex_init(&job.lock, NULL);\n\
+    pthread_cond_init(&job.cond, NULL);\n\
+    for (size_t pos = 0; pos < size; ) {\n\
+        size_t end = size - pos > GREP_CHUNK ? pos + GREP_CHUNK : size;\n\
+        const unsigned char *nl = end < size ? memchr(data + end, '\\n', size - end) : NULL;\n\
+        end = nl != NULL ? (size_t)(nl - data) + 1 : size;\n\
+        grep_chunk_t *chunk = &job.chunks[job.chunk_count++];\n\
+        chunk->start = data + pos;\n\
+        chunk->end = data + end;\n\
+        chunk->lines = NULL;\n\
+        chunk->count = chunk->capacity = 0;\n\
+        chunk->done = 0;\n\
+        pos = end;\n\
+    }\n\
+\n\
+    if ((size_t)threads > job.chunk_count) {\n\
+        threads = job.chunk_count;\n\
+    }\n\
+    pthread_t *workers = malloc((threads + 1) * sizeof(pthread_t));\n\
+    for (int t = 0; t < threads; ++t) {\n\
+        pthread_create(&workers[t], NULL, grep_worker, &job);\n\
+    }\n\
+\n\
+    long long total = 0;\n\
+    for (size_t i = 0; i < job.chunk_count; ++i) {\n\
+        grep_chunk_t *chunk = &job.chunks[i];\n\
+        pthread_mutex_lock(&job.lock);\n\
+        while (!chunk->done) {\n\
+            pthread_cond_wait(&job.cond, &job.lock);\n\
+        }\n\
+        pthread_mutex_unlock(&job.lock);\n\
+\n\
+        total += chunk->count;\n\
+        for (size_t j = 0; !count_only && j < chunk->count; ++j) {\n\
+            const unsigned char *line = chunk->lines[2 * j], *eol = chunk->lines[2 * j + 1];\n\
+            if (show_name) {\n\
+                fputs(path, stdout);\n\
+                putchar(':');\n\
+            }\n\
+            fwrite(line, 1, eol - line, stdout);\n\
+            if (eol[-1] != '\\n') {\n\
+                putchar('\\n');\n\
+            }\n\
+        }\n\
+        free(chunk->lines);\n\
+    }\n\
+    if (count_only) {\n\
+        if (show_name) {\n\
+            printf(\"%s:\", path);\n\
+        }\n\
+        printf(\"%lld\\n\", total);\n\
+    }\n\
+\n\
+    for (int t = 0; t < threads; ++t) {\n\
+        pthread_join(workers[t], NULL);\n\
+    }\n\
+    free(workers);\n\
+    free(job.chunks);\n\
+    pthread_mutex_destroy(&job.lock);\n\
+    pthread_cond_destroy(&job.cond);\n\
+    if (size > 0) {\n\
+        munmap((void *)data, size);\n\
+    }\n\
+    close(fd);\n\
+    return total;\n\
+}\n\
+\n\
+int main(int argc, char *argv[]) {\n\
+    int count_only = 0, threads = 0, first = 1;\n\
+    for (; first < argc && argv[first][0] == '-'; ++first) {\n\
+        if (!strcmp(argv[first], \"-c\")) {\n\
+            count_only = 1;\n\
+        } else if (!strcmp(argv[first], \"-j\") && first + 1 < argc) {\n\
+            threads = atoi(argv[++first]);\n\
+        } else {\n\
+            break;\n\
+        }\n\
+    }\n\
+    if (first == argc) {\n\
+        fprintf(stderr, \"usage: %s [-c] [-j threads] file...\\n\", argv[0]);\n\
+        return 2;\n\
+    }\n\
+    if (threads <= 0) {\n\
+        long online = sysconf(_SC_NPROCESSORS_ONLN);\n\
+        threads = online > 0 ? (int)online : 1;\n\
+    }\n\
+\n\
+    static char buffer[1 << 16];\n\
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));\n\
+\n\
+    int status = 1;\n\
+    for (int i = first; i < argc; ++i) {\n\
+        long long found = grep_file(argv[i], count_only, threads, argc - first > 1);\n\
+        if (found < 0) {\n\
+            status = 2;\n\
+        } else if (found > 0 && status == 1) {\n\
+            status = 0;\n\
+        }\n\
+    }\n\
+    return status;\n\
+}\n", out);
+}
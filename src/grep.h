@@ -0,0 +1,14 @@
+#ifndef GREP_H_
+#define GREP_H_
+
+#include <stdio.h>
+
+#include "regtree.h"
+
+// Lines never contain '\n', so it is removed from every charset before the
+// automaton is built; search() can then scan a whole chunk at once.
+extern void grep_prepare(RegexNode *regex);
+// a main() that prints or counts the matching lines of files
+extern void emit_grep_main(FILE *out);
+
+#endif
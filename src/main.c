@@ -1,167 +1,483 @@
+// fork(), wait() and sysconf() for --batch, open_memstream() for --prefix
+// are POSIX, not C11
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "xutils.h"
 #include "regtree.h"
+#include "grep.h"
+#include "stats.h"
+#include "to-dfa.h"
+#include "to-lazy.h"
+#include "to-glushkov.h"
+#include "captures.h"
+#include "optimize.h"
+#include "to-tree.h"
+#include "trie.h"
+#include "prefix.h"
 
 void help(void) {
-    unimplemented("help");
+    fprintf(stderr, "\
+usage: regex-to-c [options] [--] {regex}\n\
+       regex-to-c [options] -f {pattern file}\n\
+       regex-to-c [options] --batch {pattern file} [-j N] [-o DIR]\n\
+\n\
+options:\n\
+    -b auto     glushkov when the regex has at most 64 positions, else\n\
+                tree for a list of keywords and dfa otherwise (default,\n\
+                dfa with -e or -f)\n\
+    -b glushkov run the position automaton bit parallel in a uint64_t\n\
+    -b dfa      compile to a minimal DFA\n\
+    -b tree     emit one C function per regex tree node\n\
+    -b lazy     emit the NFA and build DFA states on demand at run time,\n\
+                for patterns whose DFA is too large to build up front\n\
+    -e direct   dfa: emit every state as a label in match() (default)\n\
+    -e table    dfa: emit a transition table walked by match()\n\
+    -c          also emit match_captures(), which reports the span of\n\
+                every parenthesized group\n\
+    -f file     dfa: compile every line of `file` into one match_set()\n\
+    -O passes   rewrite the regex tree before generating code: all\n\
+                (default, but -b tree leaves out coalesce), none, or a\n\
+                comma separated list of charset, flatten, prefix, suffix\n\
+                and coalesce\n\
+    -g          add a main() that greps files for the regex, build the\n\
+                output with `cc -O2 -pthread`\n\
+    -p          count calls and matched bytes in the generated code,\n\
+                match_dump_stats(FILE *) prints the counters\n\
+    --stats     print the time and memory each phase took, the node\n\
+                counts and the size of the output as JSON to stderr\n\
+    --batch file\n\
+                generate every line of `file` into a file of its own,\n\
+                DIR/00000.c for the first, with the other options\n\
+    -j N        --batch: generate N patterns at a time (default: one per\n\
+                CPU)\n\
+    -o DIR      --batch: where the outputs go (default: .)\n\
+    --prefix NAME\n\
+                name everything in the output NAME_..., make all but the\n\
+                entry points static and declare those in NAME.h, so that\n\
+                many matchers link into one program; with --batch, the\n\
+                prefix of DIR/00000.c is NAME00000 and its header\n\
+                DIR/00000.h\n");
+    exit(1);
 }
 
-int translate_atom(AtomNode *atom) {
-    static int cnt = 0;
-    int translate_regex(RegexNode *regex);
-
-    if (atom->is_simple_atom) {
-        printf("\
-int atom%03d(char *str) { // %s\n\
-    switch (((int)*str + 256) %% 256) {\n\
-", cnt, atom->annotation);
-        for (int i = 0; i < 256; ++i)
-            if (atom->allowed[i])
-                printf("        case %d: return 1;\n", i);
-        printf("\
-    }\n\
-    return -1;\n\
-}\n");
-    } else {
-        int id = translate_regex(atom->regex);
+typedef enum {
+    B_AUTO, B_TREE, B_DFA, B_LAZY, B_GLUSHKOV
+} Backend;
+
+// what the command line asks for, the same for every pattern
+typedef struct {
+    Backend backend;
+    DfaOptions dfa_options;
+    bool grep;
+    bool captures;
+    bool profile;
+    int passes;
+    bool passes_given;      // -O, else OPT_TREE for -b tree and OPT_ALL otherwise
+    const char *prefix;     // --prefix, or NULL
+} Options;
+
+// the patterns of a pattern file, one per line, skipping empty lines
+char **read_pattern_file(const char *path, int *count) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
 
-        printf("\
-int atom%03d(char *str) { // %s\n\
-    return regex%03d(str);\n\
-}\n\
-", cnt, atom->annotation, id);
+    char *text = NULL;
+    size_t len = 0, capacity = 0;
+    for (;;) {
+        if (len + 4096 > capacity) {
+            capacity = capacity ? capacity * 2 : 65536;
+            text = xrealloc(text, capacity);
+        }
+        size_t got = fread(text + len, 1, capacity - len - 1, file);
+        if (got == 0) {
+            break;
+        }
+        len += got;
     }
+    fclose(file);
+    text[len] = '\0';
 
-    return cnt++;
+    char **result = NULL;
+    int size = 0, result_capacity = 0;
+    char *line = text;
+    while (line < text + len) {
+        char *eol = strchr(line, '\n');
+        char *next = eol ? eol + 1 : text + len;
+        if (eol == NULL) {
+            eol = text + len;
+        }
+        if (eol > line && eol[-1] == '\r') {
+            eol -= 1;
+        }
+        *eol = '\0';
+        if (eol > line) {
+            if (size == result_capacity) {
+                result_capacity = result_capacity ? result_capacity * 2 : 16;
+                result = xrealloc(result, result_capacity * sizeof(char *));
+            }
+            result[size++] = xstrdup(line);
+        }
+        line = next;
+    }
+    free(text);
+
+    *count = size;
+    return result;
 }
 
-int translate_piece(PieceNode *piece) {
-    static int cnt = 0;
-    int id = translate_atom(piece->atom);
-    printf("\n\
-int piece%03d(char *str) { // %s\n\
-    char *str_old = str;\n\
-    for (int i = 0; i < %d; ++i) {\n\
-        int len = atom%03d(str);\n\
-        if (len == -1) {\n\
-            return -1;\n\
-        } else {\n\
-            str += len;\n\
-        }\n\
-    }\n\
-", cnt, piece->annotation, piece->min, id);
-
-    if (piece->max == -1) {
-        printf("\n\
-    int allow_empty_match = 1;\n\
-    for (;;) {\n\
-        int len = atom%03d(str);\n\
-        if (len == -1) {\n\
-            break;\n\
-        } else if (len == 0) {\n\
-            if (allow_empty_match) {\n\
-                allow_empty_match = 0;\n\
-            } else {\n\
-                break;\n\
-            }\n\
-        } else {\n\
-            str += len;\n\
-        }\n\
-    }\n\
-", id);
-    } else {
-        printf("\n\
-    for (int i = %d; i < %d; ++i) {\n\
-        int len = atom%03d(str);\n\
-        if (len == -1) {\n\
-            break;\n\
-        } else {\n\
-            str += len;\n\
-        }\n\
-    }\n\
-", piece->min, piece->max, id);
-    }
-
-    printf("\
-    return str - str_old;\n\
-}\n");
-
-    return cnt++;
+// With --stats the output goes to a temporary file first, so that the bytes
+// each phase writes can be counted even when stdout is a pipe.
+void finish_output(FILE *out) {
+    stats_report(stderr);
+    if (out == stdout) {
+        return;
+    }
+    rewind(out);
+    char buffer[65536];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), out)) > 0) {
+        fwrite(buffer, 1, got, stdout);
+    }
+    fclose(out);
 }
 
-int translate_branch(BranchNode *branch) {
-    static int cnt = 0;
-    int *pieces = malloc(sizeof(int) * branch->size);
-    for (int i = 0; i < branch->size; ++i)
-        pieces[i] = translate_piece(branch->pieces[i]);
-    printf("\n\
-int branch%03d(char *str) { // %s\n\
-    char *str_old = str;\n\
-    int len = 0;\n\
-", cnt, branch->annotation);
-    for (int i = 0; i < branch->size; ++i)
-        printf("\n\
-    len = piece%03d(str);\n\
-    if (len == -1) {\n\
-        return -1;\n\
-    } else {\n\
-        str += len;\n\
-    }\n\
-", pieces[i]);
-
-    free(pieces);
-
-    printf("\
-    return str - str_old;\n\
-}\n");
-    return cnt++;
+// everything for one pattern, from parsing it to the -g main()
+void generate(const char *pattern, Options *options, FILE *out) {
+    Backend backend = options->backend;
+    int passes = options->passes;
+    if (!options->passes_given && backend == B_TREE) {
+        // coalesce can lose -b tree matches, see optimize.h
+        passes = OPT_TREE;
+    }
+    RegexTree *tree = regtree_from_str(pattern);
+    stats_count_nodes(tree->root);
+    stats_add("patterns", 1);
+    optimize_regtree(tree, passes);
+    if (options->grep) {
+        grep_prepare(tree->root);
+        // mmap() and friends are POSIX, not C11
+        fprintf(out, "#define _POSIX_C_SOURCE 200809L\n");
+    }
+    if (backend == B_AUTO) {
+        if (glushkov_positions(tree->root) <= GLUSHKOV_MAX_POSITIONS) {
+            backend = B_GLUSHKOV;
+        } else {
+            // a long keyword list is one trie for -b tree
+            backend = trie_fits(tree->root) ? B_TREE : B_DFA;
+        }
+    } else if (backend == B_GLUSHKOV && glushkov_positions(tree->root) > GLUSHKOV_MAX_POSITIONS) {
+        fprintf(stderr, "regex-to-c: more than %d positions, use -b dfa\n", GLUSHKOV_MAX_POSITIONS);
+        exit(1);
+    }
+    if (backend == B_DFA) {
+        to_dfa(tree->root, &options->dfa_options, out);
+    } else if (backend == B_GLUSHKOV) {
+        to_glushkov(tree->root, options->profile, out);
+    } else if (backend == B_LAZY) {
+        to_lazy(tree->root, options->profile, out);
+    } else {
+        to_tree(tree->root, options->profile, out);
+    }
+    if (options->captures) {
+        // group numbers are those of the pattern as written
+        RegexTree *written = passes ? regtree_from_str(pattern) : tree;
+        emit_captures(written->root, out);
+        if (written != tree) {
+            regtree_drop(written);
+        }
+    }
+    if (options->grep) {
+        stats_begin("grep");
+        emit_grep_main(out);
+        stats_end();
+    }
+    regtree_drop(tree);
 }
 
-int translate_regex(RegexNode *regex) {
-    static int cnt = 0;
-    int *branches = malloc(sizeof(int) * regex->size);
-    for (int i = 0; i < regex->size; ++i)
-        branches[i] = translate_branch(regex->branches[i]);
-    printf("\n\
-int regex%03d(char *str) { // %s\n\
-    int len = 0;\n\
-    int max = -1;\n\
-", cnt, regex->annotation);
-    for (int i = 0; i < regex->size; ++i)
-        printf("\n\
-    len = branch%03d(str);\n\
-    if (len > max) {\n\
-        max = len;\n\
-    }\n\
-", branches[i]);
-
-    printf("\
-    return max;\n\
-}\n");
-
-    free(branches);
-    return cnt++;
+// --prefix: `code` renamed into `out`, the entry points declared in
+// dir/header, which `out` includes
+void write_prefixed(const char *code, size_t len, const char *prefix, const char *dir,
+                    const char *header, FILE *out) {
+    char *path = xmalloc(strlen(dir) + strlen(header) + 2);
+    sprintf(path, "%s/%s", dir, header);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+    prefix_symbols(code, len, prefix, header, out, file);
+    if (fclose(file) != 0) {
+        perror(path);
+        exit(1);
+    }
+    free(path);
 }
 
-void do_you_like_c(RegexNode *regex) {
-    int id = translate_regex(regex);
-    printf("\n\
-int match(char *str) {\n\
-    return regex%03d(str);\n\
-}\n", id);
+// --batch: every pattern is generated in a child process of its own, at
+// most `jobs` of them at a time, into DIR/NNNNN.c. A pattern the generator
+// aborts on only loses its own output.
+int run_batch(const char *path, Options *options, int jobs, const char *dir) {
+    int count;
+    char **patterns = read_pattern_file(path, &count);
+    pid_t *running = xmalloc(jobs * sizeof(pid_t));
+    int *running_pattern = xmalloc(jobs * sizeof(int));
+    char *name = xmalloc(strlen(dir) + 32);
+    int active = 0, next = 0, failed = 0;
+
+    while (next < count || active > 0) {
+        if (next < count && active < jobs) {
+            sprintf(name, "%s/%05d.c", dir, next);
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                FILE *out = fopen(name, "w");
+                if (out == NULL) {
+                    perror(name);
+                    _exit(1);
+                }
+                if (options->prefix == NULL) {
+                    generate(patterns[next], options, out);
+                    _exit(fclose(out) == 0 ? 0 : 1);
+                }
+                char *code;
+                size_t len;
+                FILE *buffer = open_memstream(&code, &len);
+                if (buffer == NULL) {
+                    perror("regex-to-c: open_memstream");
+                    _exit(1);
+                }
+                generate(patterns[next], options, buffer);
+                fclose(buffer);
+                char *prefix = xmalloc(strlen(options->prefix) + 16);
+                char header[16];
+                sprintf(prefix, "%s%05d", options->prefix, next);
+                sprintf(header, "%05d.h", next);
+                write_prefixed(code, len, prefix, dir, header, out);
+                _exit(fclose(out) == 0 ? 0 : 1);
+            } else if (pid == -1) {
+                perror("regex-to-c: fork");
+                exit(1);
+            }
+            running[active] = pid;
+            running_pattern[active] = next;
+            active += 1;
+            next += 1;
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) {
+            perror("regex-to-c: wait");
+            exit(1);
+        }
+        int slot = 0;
+        while (slot < active && running[slot] != pid) {
+            slot += 1;
+        }
+        if (slot == active) {
+            continue;
+        }
+        int done = running_pattern[slot];
+        active -= 1;
+        running[slot] = running[active];
+        running_pattern[slot] = running_pattern[active];
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "regex-to-c: pattern %d failed: %s\n", done, patterns[done]);
+            sprintf(name, "%s/%05d.c", dir, done);
+            remove(name);
+            if (options->prefix != NULL) {
+                sprintf(name, "%s/%05d.h", dir, done);
+                remove(name);
+            }
+            failed += 1;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        free(patterns[i]);
+    }
+    free(patterns);
+    free(running);
+    free(running_pattern);
+    free(name);
+    return failed ? 1 : 0;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2)
+    Options options = {
+        .backend = B_AUTO,
+        .dfa_options = { .emit = EMIT_DIRECT },
+        .passes = OPT_ALL,
+    };
+    char *pattern = NULL;
+    char *pattern_file = NULL;
+    char *batch_file = NULL;
+    char *batch_dir = ".";
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool jobs_given = false;
+    bool emit_given = false;
+    FILE *out = stdout;
+
+    for (int i = 1; i < argc; ++i) {
+        if (pattern == NULL && !strcmp(argv[i], "--") && i + 1 < argc) {
+            pattern = argv[++i];
+        } else if (pattern == NULL && !strcmp(argv[i], "-b") && i + 1 < argc) {
+            i += 1;
+            if (!strcmp(argv[i], "tree")) {
+                options.backend = B_TREE;
+            } else if (!strcmp(argv[i], "dfa")) {
+                options.backend = B_DFA;
+            } else if (!strcmp(argv[i], "lazy")) {
+                options.backend = B_LAZY;
+            } else if (!strcmp(argv[i], "glushkov")) {
+                options.backend = B_GLUSHKOV;
+            } else if (!strcmp(argv[i], "auto")) {
+                options.backend = B_AUTO;
+            } else {
+                help();
+            }
+        } else if (pattern == NULL && !strcmp(argv[i], "-e") && i + 1 < argc) {
+            i += 1;
+            emit_given = true;
+            if (!strcmp(argv[i], "direct")) {
+                options.dfa_options.emit = EMIT_DIRECT;
+            } else if (!strcmp(argv[i], "table")) {
+                options.dfa_options.emit = EMIT_TABLE;
+            } else {
+                help();
+            }
+        } else if (pattern == NULL && !strcmp(argv[i], "-O") && i + 1 < argc) {
+            options.passes = optimize_passes_from_str(argv[++i]);
+            options.passes_given = true;
+            if (options.passes == -1) {
+                help();
+            }
+        } else if (pattern == NULL && !strcmp(argv[i], "-c")) {
+            options.captures = true;
+        } else if (pattern == NULL && !strcmp(argv[i], "-g")) {
+            options.grep = true;
+        } else if (pattern == NULL && !strcmp(argv[i], "-p")) {
+            options.profile = true;
+            options.dfa_options.profile = true;
+        } else if (pattern == NULL && !strcmp(argv[i], "--stats")) {
+            stats_init();
+        } else if (pattern == NULL && !strcmp(argv[i], "-f") && i + 1 < argc) {
+            pattern_file = argv[++i];
+        } else if (pattern == NULL && !strcmp(argv[i], "--batch") && i + 1 < argc) {
+            batch_file = argv[++i];
+        } else if (pattern == NULL && !strcmp(argv[i], "-j") && i + 1 < argc) {
+            jobs = atol(argv[++i]);
+            jobs_given = true;
+        } else if (pattern == NULL && !strcmp(argv[i], "-o") && i + 1 < argc) {
+            batch_dir = argv[++i];
+        } else if (pattern == NULL && !strcmp(argv[i], "--prefix") && i + 1 < argc) {
+            options.prefix = argv[++i];
+        } else if (pattern == NULL && pattern_file == NULL && batch_file == NULL) {
+            pattern = argv[i];
+        } else {
+            help();
+        }
+    }
+    if (options.prefix != NULL) {
+        // a main() is no entry point, and --stats would count the bytes
+        // before the rename
+        bool valid = isalpha((unsigned char)options.prefix[0]) || options.prefix[0] == '_';
+        for (const char *c = options.prefix; *c != '\0'; ++c) {
+            valid &= isalnum((unsigned char)*c) || *c == '_';
+        }
+        if (!valid || options.grep || stats_enabled)
+            help();
+    }
+    // -e and -f only mean something to the dfa backend, for --batch too
+    if (options.backend == B_AUTO && (emit_given || pattern_file != NULL)) {
+        options.backend = B_DFA;
+    }
+    if (batch_file != NULL) {
+        if (!jobs_given && jobs < 1) {
+            jobs = 1;
+        }
+        if (pattern != NULL || pattern_file != NULL || stats_enabled || jobs < 1)
+            help();
+        return run_batch(batch_file, &options, jobs, batch_dir);
+    }
+    if (jobs_given || strcmp(batch_dir, ".")) {
         help();
-    RegexNode *result = regtree_from_str(argv[1]);
-    do_you_like_c(result);
-    regtree_drop(result);
+    }
+    if (stats_enabled) {
+        out = tmpfile();
+        if (out == NULL) {
+            perror("regex-to-c: tmpfile");
+            exit(1);
+        }
+        stats_set_output(out);
+    }
+    // --prefix: the code goes to a buffer first, and renamed to stdout
+    char *code = NULL;
+    size_t code_len = 0;
+    if (options.prefix != NULL) {
+        out = open_memstream(&code, &code_len);
+        if (out == NULL) {
+            perror("regex-to-c: open_memstream");
+            exit(1);
+        }
+    }
+    if (pattern_file != NULL) {
+        if (pattern != NULL || options.backend != B_DFA || options.grep || options.profile
+                || options.captures)
+            help();
+
+        int count;
+        char **patterns = read_pattern_file(pattern_file, &count);
+        if (count == 0) {
+            fprintf(stderr, "regex-to-c: no patterns in %s\n", pattern_file);
+            exit(1);
+        }
+        RegexTree **trees = xmalloc(count * sizeof(RegexTree *));
+        RegexNode **regexes = xmalloc(count * sizeof(RegexNode *));
+        for (int i = 0; i < count; ++i) {
+            trees[i] = regtree_from_str(patterns[i]);
+            stats_count_nodes(trees[i]->root);
+            optimize_regtree(trees[i], options.passes);
+            regexes[i] = trees[i]->root;
+        }
+        stats_add("patterns", count);
+        to_dfa_set(regexes, count, &options.dfa_options, out);
+        for (int i = 0; i < count; ++i) {
+            regtree_drop(trees[i]);
+            free(patterns[i]);
+        }
+        free(regexes);
+        free(trees);
+        free(patterns);
+    } else {
+        if (pattern == NULL)
+            help();
+        generate(pattern, &options, out);
+    }
+
+    if (options.prefix != NULL) {
+        fclose(out);
+        out = stdout;
+        char *header = xmalloc(strlen(options.prefix) + 3);
+        sprintf(header, "%s.h", options.prefix);
+        write_prefixed(code, code_len, options.prefix, ".", header, out);
+        free(header);
+        free(code);
+    }
+    finish_output(out);
     return 0;
 }
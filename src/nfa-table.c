@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "xutils.h"
+#include "nfa.h"
+#include "byteclass.h"
+#include "nfa-table.h"
+
+// an NS_SPLIT with a single edge only forwards to it
+static int skip_jumps(Nfa *nfa, int state) {
+    for (int i = 0; state != -1 && i < nfa->size; ++i) {
+        NfaState *s = &nfa->states[state];
+        if (s->type != NS_SPLIT || s->out[1] != -1) {
+            break;
+        }
+        state = s->out[0];
+    }
+    return state;
+}
+
+static int table_id(Nfa *nfa, NfaTable *table, int state) {
+    state = skip_jumps(nfa, state);
+    if (state == -1) {
+        return -1;
+    }
+    if (table->id[state] == -1) {
+        table->id[state] = table->size;
+        table->order[table->size++] = state;
+    }
+    return table->id[state];
+}
+
+extern void nfa_table_from_nfa(Nfa *nfa, NfaTable *table) {
+    table->size = 0;
+    table->id = xmalloc(nfa->size * sizeof(int));
+    table->order = xmalloc(nfa->size * sizeof(int));
+    for (int i = 0; i < nfa->size; ++i) {
+        table->id[i] = -1;
+    }
+
+    // `order` grows while we walk it, like the worklist in dfa_from_nfa()
+    table_id(nfa, table, nfa->start);
+    for (int i = 0; i < table->size; ++i) {
+        NfaState *state = &nfa->states[table->order[i]];
+        if (state->type != NS_MATCH) {
+            table_id(nfa, table, state->out[0]);
+        }
+        if (state->type == NS_SPLIT) {
+            table_id(nfa, table, state->out[1]);
+        }
+    }
+}
+
+static const char *row_type(int count) {
+    if (count <= 0xff) {
+        return "uint8_t";
+    } else if (count <= 0xffff) {
+        return "uint16_t";
+    } else {
+        return "uint32_t";
+    }
+}
+
+extern void emit_nfa_table(Nfa *nfa, NfaTable *table, const ByteClasses *classes,
+                           const char *prefix, FILE *out) {
+    char upper[32];
+    int n = 0;
+    for (; prefix[n] != '\0' && n < (int)sizeof(upper) - 1; ++n) {
+        upper[n] = toupper((unsigned char)prefix[n]);
+    }
+    upper[n] = '\0';
+
+    int none = table->size;
+    // charset indexes are never more than the NFA charsets
+    int largest = none > nfa->charset_size ? none : nfa->charset_size;
+    for (int i = 0; i < table->size; ++i) {
+        NfaState *state = &nfa->states[table->order[i]];
+        if (state->type == NS_SAVE && state->slot > largest) {
+            largest = state->slot;
+        }
+    }
+    int words = (classes->size + 31) / 32;
+
+    fprintf(out, "\n\
+#define %s_NFA_SIZE %d\n\
+#define %s_NONE %s_NFA_SIZE\n\
+#define %s_CLASSES %d\n\
+#define %s_SPLIT 0\n\
+#define %s_CHARSET 1\n\
+#define %s_MATCH 2\n\
+#define %s_SAVE 3\n\
+#define %s_ROW_TYPE %s\n", upper, table->size, upper, upper, upper, classes->size,
+            upper, upper, upper, upper, upper, row_type(largest));
+
+    fprintf(out, "\nstatic const uint8_t %s_byte_class[256] = {\n", prefix);
+    for (int c = 0; c < 256; ++c) {
+        fprintf(out, "%s%d,%s", c % 16 == 0 ? "    " : " ",
+                classes->class_of[c], c % 16 == 15 ? "\n" : "");
+    }
+    fprintf(out, "};\n");
+
+    // the classes of every charset, one bit per class; the copies of an
+    // atom in a bounded repetition all end up with the same bits
+    uint32_t *bits = xmalloc((nfa->charset_size + 1) * words * sizeof(uint32_t));
+    int *set_of = xmalloc((nfa->charset_size + 1) * sizeof(int));
+    int set_size = 0;
+    for (int i = 0; i < nfa->charset_size; ++i) {
+        uint32_t *row = bits + set_size * words;
+        memset(row, 0, words * sizeof(uint32_t));
+        for (int cls = 0; cls < classes->size; ++cls) {
+            if (charset_has(&nfa->charsets[i], classes->representative[cls])) {
+                row[cls / 32] |= (uint32_t)1 << (cls % 32);
+            }
+        }
+        set_of[i] = 0;
+        while (memcmp(bits + set_of[i] * words, row, words * sizeof(uint32_t))) {
+            set_of[i] += 1;
+        }
+        set_size += set_of[i] == set_size;
+    }
+    if (set_size == 0) {
+        memset(bits, 0, words * sizeof(uint32_t));
+        set_size = 1;
+    }
+
+    fprintf(out, "\nstatic const uint32_t %s_class_set[%d][%d] = {\n", prefix, set_size, words);
+    for (int i = 0; i < set_size; ++i) {
+        fprintf(out, "    {");
+        for (int w = 0; w < words; ++w) {
+            fprintf(out, " 0x%08lx,", (unsigned long)bits[i * words + w]);
+        }
+        fprintf(out, " },\n");
+    }
+    fprintf(out, "};\n");
+
+    fprintf(out, "\nstatic const %s_ROW_TYPE %s_nfa[%d][3] = {\n", upper, prefix, table->size);
+    for (int i = 0; i < table->size; ++i) {
+        NfaState *state = &nfa->states[table->order[i]];
+        int a = none, b = none;
+        if (state->type != NS_MATCH) {
+            a = table_id(nfa, table, state->out[0]);
+            a = a == -1 ? none : a;
+        }
+        const char *op = "MATCH";
+        if (state->type == NS_SPLIT) {
+            op = "SPLIT";
+            b = table_id(nfa, table, state->out[1]);
+            b = b == -1 ? none : b;
+        } else if (state->type == NS_CHARSET) {
+            op = "CHARSET";
+            b = set_of[state->charset];
+        } else if (state->type == NS_SAVE) {
+            op = "SAVE";
+            b = state->slot;
+        }
+        fprintf(out, "    { %s_%s, %d, %d },\n", upper, op, a, b);
+    }
+    fprintf(out, "};\n");
+
+    free(bits);
+    free(set_of);
+}
+
+extern void nfa_table_drop(NfaTable *table) {
+    free(table->id);
+    free(table->order);
+}
@@ -0,0 +1,29 @@
+#ifndef NFA_TABLE_H_
+#define NFA_TABLE_H_
+
+#include <stdio.h>
+
+#include "nfa.h"
+#include "byteclass.h"
+
+// The NFA is emitted without the jumps and without unreachable states, as
+// rows of { op, a, b }:
+//   PREFIX_SPLIT    epsilon edges to a and b
+//   PREFIX_CHARSET  to a on any byte whose class is in prefix_class_set[b]
+//   PREFIX_MATCH
+//   PREFIX_SAVE     epsilon edge to a that records the position in slot b
+// A missing edge is PREFIX_NONE. Row 0 is the start state.
+typedef struct {
+    int size;
+    int *id;        // NFA state -> emitted row, -1 if not emitted
+    int *order;     // emitted row -> NFA state
+} NfaTable;
+
+extern void nfa_table_from_nfa(Nfa *nfa, NfaTable *table);
+// PREFIX_NFA_SIZE, PREFIX_NONE, PREFIX_CLASSES, PREFIX_ROW_TYPE and the ops
+// as macros, then prefix_byte_class[256], prefix_class_set and prefix_nfa
+extern void emit_nfa_table(Nfa *nfa, NfaTable *table, const ByteClasses *classes,
+                           const char *prefix, FILE *out);
+extern void nfa_table_drop(NfaTable *table);
+
+#endif
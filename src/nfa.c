@@ -0,0 +1,220 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "xutils.h"
+#include "regtree.h"
+#include "nfa.h"
+
+// Thompson construction. Every fragment has a single entry state and a
+// single exit state; the exit is always an NS_SPLIT with no edges yet, so
+// fragments are glued together by setting `out[0]` of the exit.
+typedef struct {
+    int start, end;
+} Fragment;
+
+static Fragment build_regex(Nfa *nfa, RegexNode *regex);
+
+static int add_state(Nfa *nfa, NfaStateTypeTag type, int out0, int out1) {
+    if (nfa->size == nfa->capacity) {
+        nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 64;
+        nfa->states = xrealloc(nfa->states, nfa->capacity * sizeof(NfaState));
+    }
+    NfaState *state = &nfa->states[nfa->size];
+    state->type = type;
+    state->out[0] = out0;
+    state->out[1] = out1;
+    state->charset = -1;
+    state->pattern = -1;
+    state->slot = -1;
+    return nfa->size++;
+}
+
+static int add_charset(Nfa *nfa, const Charset *allowed) {
+    if (nfa->charset_size == nfa->charset_capacity) {
+        nfa->charset_capacity = nfa->charset_capacity ? nfa->charset_capacity * 2 : 16;
+        nfa->charsets = xrealloc(nfa->charsets, nfa->charset_capacity * sizeof(Charset));
+    }
+    nfa->charsets[nfa->charset_size] = *allowed;
+    return nfa->charset_size++;
+}
+
+static void patch(Nfa *nfa, int end, int target) {
+    nfa->states[end].out[0] = target;
+}
+
+// in a tagged NFA, `inner` is entered through a save of the group's start
+// and left through a save of its end
+static Fragment save_group(Nfa *nfa, Fragment inner, int group) {
+    Fragment result;
+    result.end = add_state(nfa, NS_SPLIT, -1, -1);
+    int close = add_state(nfa, NS_SAVE, result.end, -1);
+    nfa->states[close].slot = 2 * group + 1;
+    patch(nfa, inner.end, close);
+    result.start = add_state(nfa, NS_SAVE, inner.start, -1);
+    nfa->states[result.start].slot = 2 * group;
+    return result;
+}
+
+static int group_of(Nfa *nfa, AtomNode *atom) {
+    for (int i = 0; i + 1 < nfa->group_count; ++i) {
+        if (nfa->groups[i] == atom) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+// `charset` is the already registered charset of a simple atom, so that
+// repetitions of one atom share a single charset entry.
+static Fragment build_atom(Nfa *nfa, AtomNode *atom, int charset) {
+    Fragment result;
+
+    if (atom->is_simple_atom) {
+        result.end = add_state(nfa, NS_SPLIT, -1, -1);
+        result.start = add_state(nfa, NS_CHARSET, result.end, -1);
+        nfa->states[result.start].charset = charset;
+    } else {
+        result = build_regex(nfa, atom->regex);
+        int group = group_of(nfa, atom);
+        if (group != -1) {
+            result = save_group(nfa, result, group);
+        }
+    }
+
+    return result;
+}
+
+static Fragment build_piece(Nfa *nfa, PieceNode *piece) {
+    int charset = -1;
+    if (piece->atom->is_simple_atom) {
+        charset = add_charset(nfa, &piece->atom->allowed);
+    }
+
+    Fragment result;
+    result.start = add_state(nfa, NS_SPLIT, -1, -1);
+    result.end = add_state(nfa, NS_SPLIT, -1, -1);
+
+    int tail = result.start;
+    for (int i = 0; i < piece->min; ++i) {
+        Fragment atom = build_atom(nfa, piece->atom, charset);
+        patch(nfa, tail, atom.start);
+        tail = atom.end;
+    }
+
+    if (piece->max == -1) {
+        Fragment atom = build_atom(nfa, piece->atom, charset);
+        int loop = add_state(nfa, NS_SPLIT, atom.start, result.end);
+        patch(nfa, atom.end, loop);
+        patch(nfa, tail, loop);
+    } else {
+        for (int i = piece->min; i < piece->max; ++i) {
+            Fragment atom = build_atom(nfa, piece->atom, charset);
+            int optional = add_state(nfa, NS_SPLIT, atom.start, result.end);
+            patch(nfa, tail, optional);
+            tail = atom.end;
+        }
+        patch(nfa, tail, result.end);
+    }
+
+    return result;
+}
+
+static Fragment build_branch(Nfa *nfa, BranchNode *branch) {
+    Fragment result;
+    result.start = add_state(nfa, NS_SPLIT, -1, -1);
+
+    int tail = result.start;
+    for (int i = 0; i < branch->size; ++i) {
+        Fragment piece = build_piece(nfa, branch->pieces[i]);
+        patch(nfa, tail, piece.start);
+        tail = piece.end;
+    }
+    result.end = tail;
+
+    return result;
+}
+
+static Fragment build_regex(Nfa *nfa, RegexNode *regex) {
+    Fragment result;
+    result.end = add_state(nfa, NS_SPLIT, -1, -1);
+    result.start = result.end;
+
+    // alternatives are chained as split(b0, split(b1, ... bn))
+    for (int i = regex->size - 1; i >= 0; --i) {
+        Fragment branch = build_branch(nfa, regex->branches[i]);
+        patch(nfa, branch.end, result.end);
+        if (i == regex->size - 1) {
+            result.start = branch.start;
+        } else {
+            result.start = add_state(nfa, NS_SPLIT, branch.start, result.start);
+        }
+    }
+
+    return result;
+}
+
+extern Nfa *nfa_from_regtree(RegexNode *regex) {
+    return nfa_from_regtrees(&regex, 1);
+}
+
+extern Nfa *nfa_from_regtrees(RegexNode **regexes, int count) {
+    Nfa *result = xmalloc(sizeof(Nfa));
+    memset(result, 0, sizeof(Nfa));
+    result->pattern_count = count;
+
+    // patterns are chained like the branches of one regex, but each one
+    // ends in its own match state
+    for (int i = count - 1; i >= 0; --i) {
+        Fragment whole = build_regex(result, regexes[i]);
+        int match = add_state(result, NS_MATCH, -1, -1);
+        result->states[match].pattern = i;
+        patch(result, whole.end, match);
+        if (i == count - 1) {
+            result->start = whole.start;
+        } else {
+            result->start = add_state(result, NS_SPLIT, whole.start, result->start);
+        }
+    }
+
+    return result;
+}
+
+// groups in the order of their '(', which is a preorder walk of the tree
+static void collect_groups(Nfa *nfa, RegexNode *regex) {
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        for (int j = 0; j < branch->size; ++j) {
+            AtomNode *atom = branch->pieces[j]->atom;
+            if (atom->is_simple_atom) {
+                continue;
+            }
+            nfa->groups = xrealloc(nfa->groups, nfa->group_count * sizeof(AtomNode *));
+            nfa->groups[nfa->group_count - 1] = atom;
+            nfa->group_count += 1;
+            collect_groups(nfa, atom->regex);
+        }
+    }
+}
+
+extern Nfa *nfa_from_regtree_tagged(RegexNode *regex) {
+    Nfa *result = xmalloc(sizeof(Nfa));
+    memset(result, 0, sizeof(Nfa));
+    result->pattern_count = 1;
+    result->group_count = 1;
+    collect_groups(result, regex);
+
+    Fragment whole = save_group(result, build_regex(result, regex), 0);
+    int match = add_state(result, NS_MATCH, -1, -1);
+    result->states[match].pattern = 0;
+    patch(result, whole.end, match);
+    result->start = whole.start;
+
+    return result;
+}
+
+extern void nfa_drop(Nfa *nfa) {
+    free(nfa->groups);
+    free(nfa->states);
+    free(nfa->charsets);
+    free(nfa);
+}
@@ -0,0 +1,48 @@
+#ifndef NFA_H_
+#define NFA_H_
+
+#include <stdbool.h>
+
+#include "charset.h"
+#include "regtree.h"
+
+typedef enum {
+    NS_SPLIT, NS_CHARSET, NS_MATCH, NS_SAVE
+} NfaStateTypeTag;
+
+typedef struct {
+    NfaStateTypeTag type;
+    // NS_SPLIT: up to two epsilon edges, -1 if unused
+    // NS_CHARSET: out[0] is taken on any byte in charsets[charset]
+    // NS_SAVE: an epsilon edge out[0] that records the position in `slot`
+    int out[2];
+    int charset;
+    int slot;
+    int pattern;    // NS_MATCH: index of the pattern that matched
+} NfaState;
+
+typedef struct {
+    NfaState *states;
+    int size, capacity;
+
+    Charset *charsets;
+    int charset_size, charset_capacity;
+
+    int start;
+    int pattern_count;
+
+    // tagged NFAs: group g > 0 is groups[g - 1], numbered by its '(' from
+    // the left, and records its span in slots 2g and 2g + 1; group 0 is
+    // the whole match
+    AtomNode **groups;
+    int group_count;
+} Nfa;
+
+extern Nfa *nfa_from_regtree(RegexNode *regex);
+// one automaton for a set of patterns, with a match state for each of them
+extern Nfa *nfa_from_regtrees(RegexNode **regexes, int count);
+// an NFA for match_captures(), with NS_SAVE states around every group
+extern Nfa *nfa_from_regtree_tagged(RegexNode *regex);
+extern void nfa_drop(Nfa *nfa);
+
+#endif
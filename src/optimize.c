@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+
+#include "xutils.h"
+#include "arena.h"
+#include "token.h"
+#include "regtree.h"
+#include "stats.h"
+#include "optimize.h"
+
+// Every pass works bottom up: the groups inside a branch are optimized
+// before the branch itself, so a group is already as small as it gets when
+// flatten looks at it. Nodes a pass builds are annotated with the text of
+// the alternation they were made from.
+typedef struct {
+    Arena *arena;
+    int passes;
+    long rewrites[5];   // by pass, for --stats
+} Optimizer;
+
+static const struct {
+    const char *name;
+    int pass;
+    const char *counter;
+} pass_names[] = {
+    { "charset", OPT_CHARSET, "optimize_charset" },
+    { "flatten", OPT_FLATTEN, "optimize_flatten" },
+    { "prefix", OPT_PREFIX, "optimize_prefix" },
+    { "suffix", OPT_SUFFIX, "optimize_suffix" },
+    { "coalesce", OPT_COALESCE, "optimize_coalesce" },
+};
+
+#define PASS_COUNT ((int)(sizeof(pass_names) / sizeof(pass_names[0])))
+
+extern int optimize_passes_from_str(const char *str) {
+    if (!strcmp(str, "all")) {
+        return OPT_ALL;
+    } else if (!strcmp(str, "none")) {
+        return 0;
+    }
+
+    int passes = 0;
+    while (*str != '\0') {
+        size_t len = strcspn(str, ",");
+        int i = 0;
+        while (i < PASS_COUNT && (strlen(pass_names[i].name) != len
+                    || strncmp(pass_names[i].name, str, len))) {
+            i += 1;
+        }
+        if (i == PASS_COUNT) {
+            return -1;
+        }
+        passes |= pass_names[i].pass;
+        str += len + (str[len] == ',');
+    }
+    return passes;
+}
+
+static void count_rewrite(Optimizer *opt, int pass, long count) {
+    for (int i = 0; i < PASS_COUNT; ++i) {
+        if (pass_names[i].pass == pass) {
+            opt->rewrites[i] += count;
+        }
+    }
+}
+
+static bool regex_equal(RegexNode *a, RegexNode *b);
+
+static bool piece_equal(PieceNode *a, PieceNode *b) {
+    if (a->min != b->min || a->max != b->max
+            || a->atom->is_simple_atom != b->atom->is_simple_atom) {
+        return false;
+    } else if (a->atom->is_simple_atom) {
+        return !memcmp(&a->atom->allowed, &b->atom->allowed, sizeof(Charset));
+    } else {
+        return regex_equal(a->atom->regex, b->atom->regex);
+    }
+}
+
+static bool branch_equal(BranchNode *a, BranchNode *b) {
+    if (a->size != b->size) {
+        return false;
+    }
+    for (int i = 0; i < a->size; ++i) {
+        if (!piece_equal(a->pieces[i], b->pieces[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool regex_equal(RegexNode *a, RegexNode *b) {
+    if (a->size != b->size) {
+        return false;
+    }
+    for (int i = 0; i < a->size; ++i) {
+        if (!branch_equal(a->branches[i], b->branches[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// cheap to compare first: equal pieces always hash the same
+static unsigned piece_hash(PieceNode *piece) {
+    unsigned hash = 2166136261u;
+    hash = (hash ^ (unsigned)piece->min) * 16777619u;
+    hash = (hash ^ (unsigned)piece->max) * 16777619u;
+    if (piece->atom->is_simple_atom) {
+        for (int i = 0; i < 32; ++i) {
+            hash = (hash ^ piece->atom->allowed.bits[i]) * 16777619u;
+        }
+    } else {
+        hash = (hash ^ (unsigned)piece->atom->regex->size) * 16777619u;
+    }
+    return hash;
+}
+
+static int regex_width(RegexNode *regex);
+
+// the length of every match of the piece, or -1 if they differ
+static int piece_width(PieceNode *piece) {
+    if (piece->min != piece->max) {
+        return -1;
+    }
+    int width = piece->atom->is_simple_atom ? 1 : regex_width(piece->atom->regex);
+    if (width < 0 || (width > 0 && piece->min > INT_MAX / 2 / width)) {
+        return -1;
+    }
+    return piece->min * width;
+}
+
+static int pieces_width(PieceNode **pieces, int size) {
+    int width = 0;
+    for (int i = 0; i < size; ++i) {
+        int w = piece_width(pieces[i]);
+        if (w < 0 || w > INT_MAX / 2 - width) {
+            return -1;
+        }
+        width += w;
+    }
+    return width;
+}
+
+static int regex_width(RegexNode *regex) {
+    int width = pieces_width(regex->branches[0]->pieces, regex->branches[0]->size);
+    for (int i = 1; width >= 0 && i < regex->size; ++i) {
+        if (pieces_width(regex->branches[i]->pieces, regex->branches[i]->size) != width) {
+            return -1;
+        }
+    }
+    return width;
+}
+
+// the text from `start` to `end`, or from `start` on for `len` bytes when
+// `end` is not behind it
+static int anno_len_to(const char *start, int len, const char *end) {
+    return end >= start + len ? (int)(end - start) : len;
+}
+
+static BranchNode *new_branch(Optimizer *opt, PieceNode **pieces, int size,
+                              const char *anno_start, int anno_len) {
+    BranchNode *branch = arena_alloc(opt->arena, sizeof(BranchNode));
+    branch->anno_start = anno_start;
+    branch->anno_len = anno_len;
+    branch->pieces = pieces;
+    branch->size = size;
+    return branch;
+}
+
+// a new regex with room for `size` branches, for the alternation `from`
+static RegexNode *new_regex(Optimizer *opt, int size, RegexNode *from) {
+    RegexNode *regex = arena_alloc(opt->arena, sizeof(RegexNode));
+    regex->anno_start = from->anno_start;
+    regex->anno_len = from->anno_len;
+    regex->branches = arena_alloc(opt->arena, size * sizeof(BranchNode *));
+    regex->size = 0;
+    return regex;
+}
+
+// a new {1,1} piece around `regex`, for the alternation `from`
+static PieceNode *new_group(Optimizer *opt, RegexNode *regex, RegexNode *from) {
+    AtomNode *atom = arena_alloc(opt->arena, sizeof(AtomNode));
+    atom->anno_start = from->anno_start;
+    atom->anno_len = from->anno_len;
+    atom->is_simple_atom = false;
+    atom->regex = regex;
+
+    PieceNode *piece = arena_alloc(opt->arena, sizeof(PieceNode));
+    piece->anno_start = from->anno_start;
+    piece->anno_len = from->anno_len;
+    piece->atom = atom;
+    piece->min = 1;
+    piece->max = 1;
+    return piece;
+}
+
+static bool is_single_byte(BranchNode *branch) {
+    return branch->size == 1 && branch->pieces[0]->atom->is_simple_atom
+        && branch->pieces[0]->min == 1 && branch->pieces[0]->max == 1;
+}
+
+// the branches that are one byte each become one charset, in the place of
+// the first of them
+static void merge_charsets(Optimizer *opt, RegexNode *regex) {
+    int first = -1, last = -1;
+    for (int i = 0; i < regex->size; ++i) {
+        if (is_single_byte(regex->branches[i])) {
+            first = first == -1 ? i : first;
+            last = i;
+        }
+    }
+    if (first == last) {
+        return;
+    }
+
+    BranchNode *branch = regex->branches[first];
+    int anno_len = anno_len_to(branch->anno_start, branch->anno_len,
+                               regex->branches[last]->anno_start + regex->branches[last]->anno_len);
+    AtomNode *atom = arena_alloc(opt->arena, sizeof(AtomNode));
+    *atom = *branch->pieces[0]->atom;
+    atom->anno_len = anno_len;
+    PieceNode **pieces = arena_alloc(opt->arena, sizeof(PieceNode *));
+    pieces[0] = arena_alloc(opt->arena, sizeof(PieceNode));
+    *pieces[0] = *branch->pieces[0];
+    pieces[0]->atom = atom;
+    pieces[0]->anno_len = anno_len;
+
+    int size = 0;
+    for (int i = 0; i < regex->size; ++i) {
+        if (i == first) {
+            regex->branches[size++] = new_branch(opt, pieces, 1, branch->anno_start, anno_len);
+        } else if (!is_single_byte(regex->branches[i])) {
+            regex->branches[size++] = regex->branches[i];
+        } else {
+            const Charset *other = &regex->branches[i]->pieces[0]->atom->allowed;
+            for (int b = 0; b < 32; ++b) {
+                atom->allowed.bits[b] |= other->bits[b];
+            }
+            count_rewrite(opt, OPT_CHARSET, 1);
+        }
+    }
+    regex->size = size;
+}
+
+static bool is_once(PieceNode *piece) {
+    return piece->min == 1 && piece->max == 1;
+}
+
+// A group with a single branch is spliced into the branch around it, or
+// with a single piece that is there once, gives that piece's atom to the
+// repetition around it: (ab)c -> abc, (a){2} -> a{2}.
+static void flatten_branch(Optimizer *opt, BranchNode *branch) {
+    int size = 0;
+    bool splice = false;
+    for (int i = 0; i < branch->size; ++i) {
+        PieceNode *piece = branch->pieces[i];
+        AtomNode *atom = piece->atom;
+        if (!atom->is_simple_atom && atom->regex->size == 1 && !is_once(piece)
+                && atom->regex->branches[0]->size == 1
+                && is_once(atom->regex->branches[0]->pieces[0])) {
+            piece->atom = atom->regex->branches[0]->pieces[0]->atom;
+            count_rewrite(opt, OPT_FLATTEN, 1);
+        }
+        if (is_once(piece) && !piece->atom->is_simple_atom && piece->atom->regex->size == 1) {
+            size += piece->atom->regex->branches[0]->size;
+            splice = true;
+        } else {
+            size += 1;
+        }
+    }
+    if (!splice) {
+        return;
+    }
+
+    PieceNode **pieces = arena_alloc(opt->arena, size * sizeof(PieceNode *));
+    size = 0;
+    for (int i = 0; i < branch->size; ++i) {
+        PieceNode *piece = branch->pieces[i];
+        if (is_once(piece) && !piece->atom->is_simple_atom && piece->atom->regex->size == 1) {
+            BranchNode *inner = piece->atom->regex->branches[0];
+            memcpy(pieces + size, inner->pieces, inner->size * sizeof(PieceNode *));
+            size += inner->size;
+            count_rewrite(opt, OPT_FLATTEN, 1);
+        } else {
+            pieces[size++] = piece;
+        }
+    }
+    branch->pieces = pieces;
+    branch->size = size;
+}
+
+static bool can_coalesce(PieceNode *a, PieceNode *b) {
+    if (!a->atom->is_simple_atom || !b->atom->is_simple_atom
+            || memcmp(&a->atom->allowed, &b->atom->allowed, sizeof(Charset))) {
+        return false;
+    }
+    return a->min + b->min <= DUP_MAX
+        && (a->max == -1 || b->max == -1 || a->max + b->max <= DUP_MAX);
+}
+
+// neighbouring repetitions of one charset: a{1,2}a* -> a{2,}
+static void coalesce_branch(Optimizer *opt, BranchNode *branch) {
+    int size = 0;
+    for (int i = 0; i < branch->size; ++i) {
+        PieceNode *piece = branch->pieces[i];
+        PieceNode *prev = size > 0 ? branch->pieces[size - 1] : NULL;
+        if (prev == NULL || !can_coalesce(prev, piece)) {
+            branch->pieces[size++] = piece;
+            continue;
+        }
+        PieceNode *merged = arena_alloc(opt->arena, sizeof(PieceNode));
+        *merged = *prev;
+        merged->min = prev->min + piece->min;
+        merged->max = prev->max == -1 || piece->max == -1 ? -1 : prev->max + piece->max;
+        merged->anno_len = anno_len_to(prev->anno_start, prev->anno_len,
+                                       piece->anno_start + piece->anno_len);
+        branch->pieces[size - 1] = merged;
+        count_rewrite(opt, OPT_COALESCE, 1);
+    }
+    branch->size = size;
+}
+
+static void rewrite_regex(Optimizer *opt, RegexNode *regex);
+
+// the passes that look at a single branch
+static void rewrite_branch(Optimizer *opt, BranchNode *branch) {
+    if (opt->passes & OPT_FLATTEN) {
+        flatten_branch(opt, branch);
+    }
+    if (opt->passes & OPT_COALESCE) {
+        coalesce_branch(opt, branch);
+    }
+}
+
+// the branches in `members` that share their first `common` pieces, as
+// those pieces and then a group of what is left of each branch
+static BranchNode *factor_prefix(Optimizer *opt, RegexNode *regex,
+                                 int *members, int count, int common) {
+    BranchNode *first = regex->branches[members[0]];
+    RegexNode *inner = new_regex(opt, count, regex);
+    bool has_empty = false;
+    for (int m = 0; m < count; ++m) {
+        BranchNode *branch = regex->branches[members[m]];
+        const char *end = branch->anno_start + branch->anno_len;
+        if (branch->size == common) {
+            // the branch is all prefix, once is enough
+            if (!has_empty) {
+                inner->branches[inner->size++] = new_branch(opt, NULL, 0, end, 0);
+            }
+            has_empty = true;
+            continue;
+        }
+        const char *start = branch->pieces[common]->anno_start;
+        inner->branches[inner->size++] = new_branch(opt, branch->pieces + common,
+                                                    branch->size - common, start, end - start);
+    }
+
+    bool all_empty = inner->size == 1 && has_empty;
+    int size = common + !all_empty;
+    PieceNode **pieces = arena_alloc(opt->arena, size * sizeof(PieceNode *));
+    memcpy(pieces, first->pieces, common * sizeof(PieceNode *));
+    if (!all_empty) {
+        rewrite_regex(opt, inner);
+        pieces[common] = new_group(opt, inner, regex);
+    }
+    BranchNode *result = new_branch(opt, pieces, size, regex->anno_start, regex->anno_len);
+    rewrite_branch(opt, result);
+    return result;
+}
+
+// the branches in `members` that share their last `common` pieces, as a
+// group of what is in front of those and then those pieces
+static BranchNode *factor_suffix(Optimizer *opt, RegexNode *regex,
+                                 int *members, int count, int common) {
+    BranchNode *first = regex->branches[members[0]];
+    RegexNode *inner = new_regex(opt, count, regex);
+    inner->size = count;
+    for (int m = 0; m < count; ++m) {
+        BranchNode *branch = regex->branches[members[m]];
+        int size = branch->size - common;
+        int len = size > 0 ? anno_len_to(branch->anno_start, 0,
+                                         branch->pieces[size - 1]->anno_start
+                                         + branch->pieces[size - 1]->anno_len) : 0;
+        inner->branches[m] = new_branch(opt, branch->pieces, size, branch->anno_start, len);
+    }
+    rewrite_regex(opt, inner);
+
+    PieceNode **pieces = arena_alloc(opt->arena, (common + 1) * sizeof(PieceNode *));
+    pieces[0] = new_group(opt, inner, regex);
+    memcpy(pieces + 1, first->pieces + first->size - common, common * sizeof(PieceNode *));
+    BranchNode *result = new_branch(opt, pieces, common + 1, regex->anno_start, regex->anno_len);
+    rewrite_branch(opt, result);
+    return result;
+}
+
+// the piece at `index` from the front, or from the back when `from_back`
+static PieceNode *piece_at(BranchNode *branch, int index, bool from_back) {
+    return branch->pieces[from_back ? branch->size - 1 - index : index];
+}
+
+// Branches with an equal first (or last) piece are factored together, in
+// the place of the first of them. For -b tree, every branch of a regex is
+// tried and the longest one wins, so the order they end up in does not
+// matter; equal prefixes match the same bytes in all of them. Suffixes
+// only line up when what is in front of them is equally long in every
+// branch, so branches are only factored with others of the same width.
+static void factor(Optimizer *opt, RegexNode *regex, bool from_back) {
+    if (regex->size < 2) {
+        return;
+    }
+    int size = regex->size;
+    unsigned *hash = xmalloc(size * sizeof(unsigned));
+    bool *taken = xmalloc(size * sizeof(bool));
+    int *members = xmalloc(size * sizeof(int));
+    int *width = xmalloc(size * sizeof(int));
+    int *group = xmalloc(size * sizeof(int));
+    BranchNode **result = xmalloc(size * sizeof(BranchNode *));
+    for (int i = 0; i < size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        hash[i] = branch->size > 0 ? piece_hash(piece_at(branch, 0, from_back)) : 0;
+        taken[i] = false;
+    }
+
+    int out = 0;
+    for (int i = 0; i < size; ++i) {
+        if (taken[i]) {
+            continue;
+        }
+        BranchNode *first = regex->branches[i];
+        int count = 1;
+        members[0] = i;
+        for (int j = i + 1; first->size > 0 && j < size; ++j) {
+            BranchNode *branch = regex->branches[j];
+            if (!taken[j] && branch->size > 0 && hash[j] == hash[i]
+                    && piece_equal(piece_at(first, 0, from_back), piece_at(branch, 0, from_back))) {
+                members[count++] = j;
+                taken[j] = true;
+            }
+        }
+        if (count == 1) {
+            result[out++] = first;
+            continue;
+        }
+
+        int common = first->size;
+        for (int m = 1; m < count; ++m) {
+            BranchNode *branch = regex->branches[members[m]];
+            int k = 0;
+            while (k < common && k < branch->size
+                    && piece_equal(piece_at(first, k, from_back), piece_at(branch, k, from_back))) {
+                k += 1;
+            }
+            common = k;
+        }
+
+        if (!from_back) {
+            result[out++] = factor_prefix(opt, regex, members, count, common);
+            count_rewrite(opt, OPT_PREFIX, count - 1);
+            continue;
+        }
+
+        for (int m = 0; m < count; ++m) {
+            BranchNode *branch = regex->branches[members[m]];
+            width[m] = pieces_width(branch->pieces, branch->size - common);
+        }
+        for (int m = 0; m < count; ++m) {
+            if (members[m] == -1) {
+                continue;
+            }
+            int same = 0;
+            for (int n = m; n < count; ++n) {
+                if (members[n] != -1 && (n == m || (width[m] >= 0 && width[n] == width[m]))) {
+                    group[same++] = members[n];
+                    members[n] = -1;
+                }
+            }
+            if (same == 1) {
+                result[out++] = regex->branches[group[0]];
+            } else {
+                result[out++] = factor_suffix(opt, regex, group, same, common);
+                count_rewrite(opt, OPT_SUFFIX, same - 1);
+            }
+        }
+    }
+    memcpy(regex->branches, result, out * sizeof(BranchNode *));
+    regex->size = out;
+
+    free(hash);
+    free(taken);
+    free(members);
+    free(width);
+    free(group);
+    free(result);
+}
+
+// the passes that look at the branches of a regex together
+static void rewrite_regex(Optimizer *opt, RegexNode *regex) {
+    if (opt->passes & OPT_CHARSET) {
+        merge_charsets(opt, regex);
+    }
+    if (opt->passes & OPT_PREFIX) {
+        factor(opt, regex, false);
+    }
+    if (opt->passes & OPT_SUFFIX) {
+        factor(opt, regex, true);
+    }
+}
+
+static void optimize_regex(Optimizer *opt, RegexNode *regex) {
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        for (int j = 0; j < branch->size; ++j) {
+            if (!branch->pieces[j]->atom->is_simple_atom) {
+                optimize_regex(opt, branch->pieces[j]->atom->regex);
+            }
+        }
+        rewrite_branch(opt, branch);
+    }
+    rewrite_regex(opt, regex);
+}
+
+extern void optimize_regtree(RegexTree *tree, int passes) {
+    if (passes == 0) {
+        return;
+    }
+    stats_begin("optimize");
+    Optimizer opt;
+    opt.arena = &tree->arena;
+    opt.passes = passes;
+    memset(opt.rewrites, 0, sizeof(opt.rewrites));
+    optimize_regex(&opt, tree->root);
+    for (int i = 0; i < PASS_COUNT; ++i) {
+        stats_add(pass_names[i].counter, opt.rewrites[i]);
+    }
+    stats_end();
+}
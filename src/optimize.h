@@ -0,0 +1,31 @@
+#ifndef OPTIMIZE_H_
+#define OPTIMIZE_H_
+
+#include "regtree.h"
+
+#define OPT_CHARSET     1   // a|b|c -> [abc]
+#define OPT_FLATTEN     2   // ((x)) -> x, a(bc)d -> abcd
+#define OPT_PREFIX      4   // ne.er|never -> ne(.er|ver)
+#define OPT_SUFFIX      8   // xa|ya -> (x|y)a, when x and y are equally long
+#define OPT_COALESCE    16  // a*a+ -> a+
+#define OPT_ALL         31
+// what -b tree runs without -O, see below
+#define OPT_TREE        (OPT_ALL & ~OPT_COALESCE)
+
+// "all", "none" or a comma separated list of pass names, like
+// "flatten,prefix"; -1 for anything else
+extern int optimize_passes_from_str(const char *str);
+// Rewrites the tree in place, new nodes come from its arena. The passes
+// keep the language. Only coalesce changes what -b tree matches: wherever
+// the pieces it joins matched, the joined one matches as much, and it also
+// matches where greedy pieces one by one gave up too early (a*a on "a").
+// Without backtracking that can cut both ways: a branch that now matches
+// may win the regex around it and leave too little for what follows, so
+// (.+..|)ac no longer matches "acbc". That is why -b tree leaves coalesce
+// out unless -O asks for it.
+//
+// Groups are merged and moved around, so match_captures() has to be
+// emitted from a tree that was not optimized.
+extern void optimize_regtree(RegexTree *tree, int passes);
+
+#endif
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "xutils.h"
+#include "prefix.h"
+
+// What a program calls a generated matcher by. Every other name the
+// backends emit is theirs to rename and hide, so a new entry point has to
+// be added here.
+static const char *const api[] = {
+    "match", "match_n", "search", "match_set", "MATCH_SET_SIZE",
+    "match_state_t", "match_init", "match_feed", "match_finish", "match_batch",
+    "match_cache_free", "match_dump_stats",
+    "match_captures", "match_captures_free", "MATCH_CAPTURES", "MATCH_NO_CAPTURE",
+};
+
+// followed by a { at file scope, but no names of their own
+static const char *const keywords[] = { "struct", "union", "enum", "sizeof" };
+
+typedef enum {
+    T_SPACE, T_COMMENT, T_IDENT, T_LITERAL, T_PUNCT
+} TokenKind;
+
+typedef struct {
+    const char *start;
+    int len;
+    TokenKind kind;
+    bool directive;     // on a preprocessor line
+} Tok;
+
+// a declaration, a function definition or a preprocessor line at file scope
+typedef struct {
+    int begin;          // the comments and blank lines in front of it
+    int first;          // its first token
+    int end;
+    int body;           // the { of a function definition, else -1
+    bool directive;
+    bool is_static, is_typedef, declares_object;
+    bool public;
+} Item;
+
+typedef struct {
+    Tok *toks;
+    int size, capacity;
+    Item *items;
+    int item_size, item_capacity;
+    // open addressing: the names defined at file scope, NULL for empty slots
+    const Tok **names;
+    int name_size, name_capacity;
+} Prefixer;
+
+static bool is_ident_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static bool tok_is(const Tok *tok, const char *str) {
+    return tok->len == (int)strlen(str) && !memcmp(tok->start, str, tok->len);
+}
+
+static bool punct_is(const Tok *tok, char c) {
+    return tok->kind == T_PUNCT && tok->start[0] == c;
+}
+
+static bool in_list(const Tok *tok, const char *const *list, int size) {
+    for (int i = 0; i < size; ++i) {
+        if (tok_is(tok, list[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_tok(Prefixer *p, const char *start, int len, TokenKind kind, bool directive) {
+    if (p->size == p->capacity) {
+        p->capacity = p->capacity ? p->capacity * 2 : 1024;
+        p->toks = xrealloc(p->toks, p->capacity * sizeof(Tok));
+    }
+    p->toks[p->size++] = (Tok){ start, len, kind, directive };
+}
+
+// good enough for what the backends emit: no trigraphs, no digraphs, no
+// line splices outside of preprocessor lines
+static void tokenize(Prefixer *p, const char *code, size_t len) {
+    const char *str = code, *end = code + len;
+    bool line_start = true, directive = false;
+    while (str < end) {
+        const char *start = str;
+        if (*str == '\n' && directive) {
+            // a backslash right before it continues the line
+            directive = p->size > 0 && punct_is(&p->toks[p->size - 1], '\\');
+            add_tok(p, start, 1, T_SPACE, directive);
+            line_start = true;
+            str += 1;
+            continue;
+        }
+        if (isspace((unsigned char)*str)) {
+            while (str < end && isspace((unsigned char)*str) && !(*str == '\n' && directive)) {
+                line_start |= *str == '\n';
+                str += 1;
+            }
+            add_tok(p, start, str - start, T_SPACE, directive);
+            continue;
+        }
+
+        TokenKind kind = T_PUNCT;
+        if (*str == '#' && line_start) {
+            directive = true;
+            str += 1;
+        } else if (str + 1 < end && str[0] == '/' && str[1] == '/') {
+            kind = T_COMMENT;
+            while (str < end && *str != '\n') {
+                str += 1;
+            }
+        } else if (str + 1 < end && str[0] == '/' && str[1] == '*') {
+            kind = T_COMMENT;
+            str += 2;
+            while (str + 1 < end && !(str[0] == '*' && str[1] == '/')) {
+                str += 1;
+            }
+            str = str + 2 < end ? str + 2 : end;
+        } else if (*str == '"' || *str == '\'') {
+            kind = T_LITERAL;
+            char quote = *str++;
+            while (str < end && *str != quote) {
+                str += *str == '\\' && str + 1 < end ? 2 : 1;
+            }
+            str = str < end ? str + 1 : end;
+        } else if (isdigit((unsigned char)*str)) {
+            kind = T_LITERAL;
+            while (str < end && (is_ident_char(*str) || *str == '.')) {
+                str += 1;
+            }
+        } else if (is_ident_char(*str)) {
+            kind = T_IDENT;
+            while (str < end && is_ident_char(*str)) {
+                str += 1;
+            }
+        } else {
+            str += 1;
+        }
+        add_tok(p, start, str - start, kind, directive);
+        line_start = false;
+    }
+}
+
+static uint32_t hash_name(const Tok *tok) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < tok->len; ++i) {
+        hash ^= (unsigned char)tok->start[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const Tok **find_name(Prefixer *p, const Tok *tok) {
+    uint32_t mask = p->name_capacity - 1;
+    for (uint32_t h = hash_name(tok) & mask; ; h = (h + 1) & mask) {
+        const Tok *name = p->names[h];
+        if (name == NULL || (name->len == tok->len && !memcmp(name->start, tok->start, tok->len))) {
+            return &p->names[h];
+        }
+    }
+}
+
+static bool is_name(Prefixer *p, const Tok *tok) {
+    return tok->kind == T_IDENT && p->name_capacity > 0 && *find_name(p, tok) != NULL;
+}
+
+static void add_name(Prefixer *p, const Tok *tok) {
+    // reserved names like __attribute__, and the R2C_ knobs a program sets
+    // with -D, keep theirs
+    if (tok->start[0] == '_' || (tok->len > 4 && !memcmp(tok->start, "R2C_", 4))
+            || in_list(tok, keywords, sizeof(keywords) / sizeof(keywords[0]))) {
+        return;
+    }
+    if (2 * (p->name_size + 1) > p->name_capacity) {
+        const Tok **old = p->names;
+        int old_capacity = p->name_capacity;
+        p->name_capacity = p->name_capacity ? p->name_capacity * 2 : 256;
+        p->names = xmalloc(p->name_capacity * sizeof(Tok *));
+        memset(p->names, 0, p->name_capacity * sizeof(Tok *));
+        for (int i = 0; i < old_capacity; ++i) {
+            if (old[i] != NULL) {
+                *find_name(p, old[i]) = old[i];
+            }
+        }
+        free(old);
+    }
+    const Tok **slot = find_name(p, tok);
+    if (*slot == NULL) {
+        *slot = tok;
+        p->name_size += 1;
+    }
+}
+
+static int skip_space(Prefixer *p, int i, int end) {
+    while (i < end && (p->toks[i].kind == T_SPACE || p->toks[i].kind == T_COMMENT)) {
+        i += 1;
+    }
+    return i;
+}
+
+static bool is_api(const Tok *tok) {
+    return in_list(tok, api, sizeof(api) / sizeof(api[0]));
+}
+
+// #define NAME
+static void scan_directive(Prefixer *p, Item *item) {
+    int i = skip_space(p, item->first + 1, item->end);
+    if (i == item->end || !tok_is(&p->toks[i], "define")) {
+        return;
+    }
+    i = skip_space(p, i + 1, item->end);
+    if (i < item->end && p->toks[i].kind == T_IDENT) {
+        add_name(p, &p->toks[i]);
+        item->public = is_api(&p->toks[i]);
+    }
+}
+
+// the names a declaration or definition introduces: at file scope, an
+// identifier in front of ( [ = ; , or {, but not in an initializer
+static void scan_declaration(Prefixer *p, Item *item) {
+    int end = item->body != -1 ? item->body : item->end;
+    int depth = 0;
+    bool initializer = false;
+    for (int i = item->first; i < end; ++i) {
+        Tok *tok = &p->toks[i];
+        if (tok->directive) {
+            continue;
+        }
+        if (tok->kind == T_PUNCT) {
+            char c = tok->start[0];
+            if (c == '(' || c == '[' || c == '{') {
+                depth += 1;
+            } else if (c == ')' || c == ']' || c == '}') {
+                depth -= 1;
+            } else if (depth == 0 && c == '=') {
+                initializer = true;
+            } else if (depth == 0 && (c == ',' || c == ';')) {
+                initializer = false;
+            }
+            continue;
+        }
+        if (tok->kind != T_IDENT || depth != 0 || initializer) {
+            continue;
+        }
+        if (tok_is(tok, "static")) {
+            item->is_static = true;
+        } else if (tok_is(tok, "typedef")) {
+            item->is_typedef = true;
+        }
+        int next = skip_space(p, i + 1, item->end);
+        if (next == item->end || p->toks[next].kind != T_PUNCT
+                || !strchr("([=;,{", p->toks[next].start[0])) {
+            continue;
+        }
+        add_name(p, tok);
+        item->public |= is_api(tok);
+        item->declares_object |= p->toks[next].start[0] != '{';
+    }
+}
+
+static void split_items(Prefixer *p) {
+    int i = 0;
+    while (i < p->size) {
+        Item item = { .begin = i, .body = -1 };
+        item.first = skip_space(p, i, p->size);
+        if (item.first == p->size) {
+            break;
+        }
+        int j = item.first;
+        if (p->toks[j].directive) {
+            item.directive = true;
+            while (j < p->size && p->toks[j].directive) {
+                j += 1;
+            }
+        } else {
+            int depth = 0, prev = -1;
+            for (; j < p->size; ++j) {
+                Tok *tok = &p->toks[j];
+                if (tok->kind == T_PUNCT && !tok->directive) {
+                    char c = tok->start[0];
+                    if (c == '{' && depth == 0 && prev != -1 && punct_is(&p->toks[prev], ')')) {
+                        item.body = j;
+                    }
+                    if (c == '(' || c == '[' || c == '{') {
+                        depth += 1;
+                    } else if (c == ')' || c == ']' || c == '}') {
+                        depth -= 1;
+                    }
+                    if (depth == 0 && ((c == '}' && item.body != -1) || c == ';')) {
+                        j += 1;
+                        break;
+                    }
+                }
+                if (tok->kind != T_SPACE && tok->kind != T_COMMENT) {
+                    prev = j;
+                }
+            }
+        }
+        item.end = j;
+
+        if (p->item_size == p->item_capacity) {
+            p->item_capacity = p->item_capacity ? p->item_capacity * 2 : 256;
+            p->items = xrealloc(p->items, p->item_capacity * sizeof(Item));
+        }
+        p->items[p->item_size++] = item;
+        i = j;
+    }
+}
+
+static void emit_tokens(Prefixer *p, int begin, int end, const char *prefix, FILE *out) {
+    // #include <stdint.h> is no place for prefixes
+    bool include = false;
+    for (int i = begin; i < end; ++i) {
+        Tok *tok = &p->toks[i];
+        if (!tok->directive) {
+            include = false;
+        } else if (punct_is(tok, '#')) {
+            int next = skip_space(p, i + 1, end);
+            include = next < end && tok_is(&p->toks[next], "include");
+        }
+        if (!include && is_name(p, tok)) {
+            fprintf(out, "%s_", prefix);
+        }
+        fwrite(tok->start, 1, tok->len, out);
+    }
+}
+
+extern void prefix_symbols(const char *code, size_t len, const char *prefix,
+                           const char *header_name, FILE *out, FILE *header) {
+    Prefixer p = { 0 };
+    tokenize(&p, code, len);
+    split_items(&p);
+    for (int i = 0; i < p.item_size; ++i) {
+        if (p.items[i].directive) {
+            scan_directive(&p, &p.items[i]);
+        } else {
+            scan_declaration(&p, &p.items[i]);
+        }
+    }
+
+    bool uses_file = false;
+    for (int i = 0; i < p.item_size; ++i) {
+        Item *item = &p.items[i];
+        for (int j = item->first; item->public && j < item->end; ++j) {
+            uses_file |= tok_is(&p.toks[j], "FILE");
+        }
+    }
+    fprintf(header, "#ifndef ");
+    for (const char *c = prefix; *c != '\0'; ++c) {
+        fputc(toupper((unsigned char)*c), header);
+    }
+    fprintf(header, "_H_\n#define ");
+    for (const char *c = prefix; *c != '\0'; ++c) {
+        fputc(toupper((unsigned char)*c), header);
+    }
+    fprintf(header, "_H_\n\n#include <stddef.h>\n#include <stdint.h>\n%s",
+            uses_file ? "#include <stdio.h>\n" : "");
+
+    // the API goes to the header: macros and types as they are, functions
+    // as prototypes, a blank line between runs of each
+    fprintf(out, "#include \"%s\"\n", header_name);
+    enum { NONE, MACRO, TYPE, PROTOTYPE };
+    int run = NONE;
+    int last = 0;
+    for (int i = 0; i < p.item_size; ++i) {
+        Item *item = &p.items[i];
+        last = item->end;
+        if (!item->public) {
+            if (!item->directive && !item->is_static && !item->is_typedef && item->declares_object) {
+                emit_tokens(&p, item->begin, item->first, prefix, out);
+                fprintf(out, "static ");
+                emit_tokens(&p, item->first, item->end, prefix, out);
+            } else {
+                emit_tokens(&p, item->begin, item->end, prefix, out);
+            }
+            continue;
+        }
+        if (item->body == -1) {
+            int kind = item->directive ? MACRO : TYPE;
+            fprintf(header, "%s", run == kind && kind == MACRO ? "" : "\n");
+            emit_tokens(&p, item->first, item->end, prefix, header);
+            fprintf(header, "\n");
+            run = kind;
+            continue;
+        }
+        int end = item->body;
+        while (end > item->first && p.toks[end - 1].kind == T_SPACE) {
+            end -= 1;
+        }
+        fprintf(header, "%s", run == PROTOTYPE ? "" : "\n");
+        emit_tokens(&p, item->first, end, prefix, header);
+        fprintf(header, ";\n");
+        run = PROTOTYPE;
+        emit_tokens(&p, item->begin, item->end, prefix, out);
+    }
+    emit_tokens(&p, last, p.size, prefix, out);
+    fprintf(header, "\n#endif\n");
+
+    free(p.toks);
+    free(p.items);
+    free(p.names);
+}
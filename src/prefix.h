@@ -0,0 +1,16 @@
+#ifndef PREFIX_H_
+#define PREFIX_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+// --prefix: rewrites the generated `code` so that many matchers can be
+// linked into one program, or included into one translation unit. Every
+// name it defines at file scope becomes prefix_name, whatever is not part
+// of the matcher's API becomes static, and the API, match_n() and friends,
+// is declared in `header`. The code written to `out` includes `header_name`
+// for the types and macros that moved there.
+extern void prefix_symbols(const char *code, size_t len, const char *prefix,
+                           const char *header_name, FILE *out, FILE *header);
+
+#endif
@@ -0,0 +1,54 @@
+#include <stdio.h>
+
+#include "profile.h"
+
+extern void emit_profile_counters(const char *name, FILE *out) {
+    fprintf(out, "\nstatic unsigned long long %s_calls, %s_matched, %s_bytes;\n", name, name, name);
+}
+
+extern void emit_profile_wrapper(const char *name, const char *params, const char *args, FILE *out) {
+    fprintf(out, "\n\
+ptrdiff_t %s(%s) {\n\
+    ptrdiff_t result = %s_body(%s);\n\
+    %s_calls += 1;\n\
+    if (result >= 0) {\n\
+        %s_matched += 1;\n\
+        %s_bytes += result;\n\
+    }\n\
+    return result;\n\
+}\n", name, params, name, args, name, name, name);
+}
+
+extern void emit_profile_dump_begin(FILE *out) {
+    fprintf(out, "\n\
+void match_dump_stats(FILE *out) {\n\
+    fprintf(out, \"%%-12s %%14s %%14s %%16s\\n\", \"function\", \"calls\", \"matched\", \"bytes\");\n");
+}
+
+extern void emit_profile_dump_row(const char *name, const char *anno_start, int anno_len, FILE *out) {
+    fprintf(out, "\
+    fprintf(out, \"%%-12s %%14llu %%14llu %%16llu  %%s\\n\", \"%s\", %s_calls, %s_matched, %s_bytes, ",
+            name, name, name, name);
+    emit_c_string(anno_start, anno_len, out);
+    fprintf(out, ");\n");
+}
+
+extern void emit_profile_dump_end(FILE *out) {
+    fprintf(out, "}\n");
+}
+
+extern void emit_c_string(const char *str, int len, FILE *out) {
+    fputc('"', out);
+    for (int i = 0; i < len; ++i) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\' || c == '?') {
+            // '?' so that "??(" can't turn into a trigraph
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
@@ -0,0 +1,22 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdio.h>
+
+// -p compiles counters into the generated code. A profiled function NAME is
+// emitted as a static NAME_body(), and NAME() around it counts its calls,
+// how many of them matched and how many bytes they matched. Without -p none
+// of this is emitted at all.
+extern void emit_profile_counters(const char *name, FILE *out);
+// `params` is the parameter list of NAME_body(), `args` passes them on
+extern void emit_profile_wrapper(const char *name, const char *params, const char *args, FILE *out);
+
+// match_dump_stats(FILE *out) prints a row for every profiled function
+extern void emit_profile_dump_begin(FILE *out);
+extern void emit_profile_dump_row(const char *name, const char *anno_start, int anno_len, FILE *out);
+extern void emit_profile_dump_end(FILE *out);
+
+// a C string literal with the given bytes
+extern void emit_c_string(const char *str, int len, FILE *out);
+
+#endif
@@ -0,0 +1,273 @@
+// fork(), dlopen() and friends are POSIX, not C11
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "xutils.h"
+#include "regtree.h"
+#include "profile.h"
+#include "to-dfa.h"
+#include "to-lazy.h"
+#include "to-glushkov.h"
+#include "to-tree.h"
+#include "trie.h"
+#include "captures.h"
+#include "optimize.h"
+#include "r2c.h"
+
+// set by the makefile to a checksum of src/, so that a changed generator
+// never loads what an older one emitted
+#ifndef R2C_SOURCE_HASH
+#define R2C_SOURCE_HASH "unknown"
+#endif
+
+#define R2C_FLAGS (R2C_DFA | R2C_TABLE | R2C_LAZY | R2C_CAPTURES)
+
+struct r2c_matcher {
+    void *handle;
+    ptrdiff_t (*match_n)(const unsigned char *buf, size_t len);
+    int (*search)(const unsigned char *buf, size_t len, size_t *start, size_t *end);
+    ptrdiff_t (*match_captures)(const unsigned char *buf, size_t len, size_t *starts, size_t *ends);
+    int captures;
+};
+
+static const char *compiler(void) {
+    const char *cc = getenv("R2C_CC");
+    return cc != NULL && cc[0] != '\0' ? cc : "cc";
+}
+
+// the cache directory, created if missing; the caller frees it
+static char *cache_dir(void) {
+    const char *env = getenv("R2C_CACHE_DIR");
+    char *dir;
+    if (env != NULL && env[0] != '\0') {
+        dir = xstrdup(env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0') {
+        dir = xstrcat(xstrdup(env), xstrdup("/regex-to-c"));
+    } else if ((env = getenv("HOME")) != NULL && env[0] != '\0') {
+        dir = xstrcat(xstrdup(env), xstrdup("/.cache/regex-to-c"));
+    } else {
+        // no shared fallback like /tmp: whatever is in the directory gets
+        // dlopen()ed, so another user must not be able to put it there
+        fprintf(stderr, "regex-to-c: no cache directory, set R2C_CACHE_DIR or HOME\n");
+        return NULL;
+    }
+
+    // mkdir -p
+    for (char *p = dir + 1; ; ++p) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+                fprintf(stderr, "regex-to-c: mkdir %s: %s\n", dir, strerror(errno));
+                free(dir);
+                return NULL;
+            }
+            *p = c;
+            if (c == '\0') {
+                break;
+            }
+        }
+    }
+    return dir;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+static uint64_t cache_key(const char *pattern, int flags) {
+    uint64_t hash = 14695981039346656037u;
+    // the terminating NULs keep "ab" + "c" apart from "a" + "bc"
+    hash = fnv1a(hash, R2C_SOURCE_HASH, sizeof(R2C_SOURCE_HASH));
+    hash = fnv1a(hash, compiler(), strlen(compiler()) + 1);
+    hash = fnv1a(hash, &flags, sizeof(flags));
+    hash = fnv1a(hash, pattern, strlen(pattern) + 1);
+    return hash;
+}
+
+extern void r2c_generate(const char *pattern, int flags, FILE *out) {
+    RegexTree *tree = regtree_from_str(pattern);
+    optimize_regtree(tree, OPT_ALL);
+    if (flags & (R2C_DFA | R2C_TABLE)) {
+        DfaOptions options = { .emit = flags & R2C_TABLE ? EMIT_TABLE : EMIT_DIRECT };
+        to_dfa(tree->root, &options, out);
+    } else if (flags & R2C_LAZY) {
+        to_lazy(tree->root, false, out);
+    } else if (glushkov_positions(tree->root) <= GLUSHKOV_MAX_POSITIONS) {
+        to_glushkov(tree->root, false, out);
+    } else if (trie_fits(tree->root)) {
+        to_tree(tree->root, false, out);
+    } else {
+        DfaOptions options = { .emit = EMIT_DIRECT };
+        to_dfa(tree->root, &options, out);
+    }
+    if (flags & R2C_CAPTURES) {
+        RegexTree *written = regtree_from_str(pattern);
+        emit_captures(written->root, out);
+        regtree_drop(written);
+    }
+    regtree_drop(tree);
+}
+
+// the generator aborts on a malformed pattern, so it runs in a child
+static void generate(const char *pattern, int flags, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "regex-to-c: %s: %s\n", path, strerror(errno));
+        _exit(1);
+    }
+    r2c_generate(pattern, flags, out);
+
+    // what r2c_compile() checks after loading
+    fprintf(out, "\nconst char r2c_pattern[] = ");
+    emit_c_string(pattern, strlen(pattern), out);
+    fprintf(out, ";\nconst int r2c_captures = %s;\n",
+            flags & R2C_CAPTURES ? "MATCH_CAPTURES" : "0");
+    _exit(fclose(out) == 0 ? 0 : 1);
+}
+
+static bool wait_child(pid_t pid, const char *what) {
+    int status;
+    if (pid == -1) {
+        fprintf(stderr, "regex-to-c: fork: %s\n", strerror(errno));
+        return false;
+    }
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            fprintf(stderr, "regex-to-c: waitpid: %s\n", strerror(errno));
+            return false;
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "regex-to-c: %s failed\n", what);
+        return false;
+    }
+    return true;
+}
+
+// generates `so`: the C file and the object are built next to it under
+// names of their own, and only renamed into place once complete, so that
+// processes filling the same cache never load half a file
+static bool build(const char *pattern, int flags, const char *so) {
+    char *source = xmalloc(strlen(so) + 32);
+    char *object = xmalloc(strlen(so) + 32);
+    sprintf(source, "%s.%ld.c", so, (long)getpid());
+    sprintf(object, "%s.%ld.tmp", so, (long)getpid());
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        generate(pattern, flags, source);
+    }
+    bool ok = wait_child(pid, "generating the matcher");
+    if (ok) {
+        pid = fork();
+        if (pid == 0) {
+            execlp(compiler(), compiler(), "-O2", "-shared", "-fPIC",
+                   "-o", object, source, (char *)NULL);
+            fprintf(stderr, "regex-to-c: %s: %s\n", compiler(), strerror(errno));
+            _exit(127);
+        }
+        ok = wait_child(pid, compiler());
+    }
+    if (ok && rename(object, so) == -1) {
+        fprintf(stderr, "regex-to-c: rename %s: %s\n", so, strerror(errno));
+        ok = false;
+    }
+
+    remove(source);
+    remove(object);
+    free(source);
+    free(object);
+    return ok;
+}
+
+// NULL if `so` is missing, or holds another pattern that hashed the same
+static r2c_matcher *load(const char *pattern, const char *so) {
+    void *handle = dlopen(so, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        return NULL;
+    }
+    const char *loaded = dlsym(handle, "r2c_pattern");
+    const int *captures = dlsym(handle, "r2c_captures");
+    r2c_matcher *matcher = xmalloc(sizeof(r2c_matcher));
+    matcher->handle = handle;
+    *(void **)&matcher->match_n = dlsym(handle, "match_n");
+    *(void **)&matcher->search = dlsym(handle, "search");
+    *(void **)&matcher->match_captures = dlsym(handle, "match_captures");
+    if (loaded == NULL || strcmp(loaded, pattern) || captures == NULL
+            || matcher->match_n == NULL || matcher->search == NULL) {
+        r2c_free(matcher);
+        return NULL;
+    }
+    matcher->captures = *captures;
+    return matcher;
+}
+
+extern r2c_matcher *r2c_compile(const char *pattern, int flags) {
+    if (flags & ~R2C_FLAGS) {
+        fprintf(stderr, "regex-to-c: unknown flags %#x\n", flags & ~R2C_FLAGS);
+        return NULL;
+    }
+    char *dir = cache_dir();
+    if (dir == NULL) {
+        return NULL;
+    }
+    char *so = xmalloc(strlen(dir) + 32);
+    sprintf(so, "%s/%016llx.so", dir, (unsigned long long)cache_key(pattern, flags));
+
+    r2c_matcher *matcher = load(pattern, so);
+    if (matcher == NULL && build(pattern, flags, so)) {
+        matcher = load(pattern, so);
+        if (matcher == NULL) {
+            fprintf(stderr, "regex-to-c: cannot load %s: %s\n", so, dlerror());
+        }
+    }
+    free(so);
+    free(dir);
+    return matcher;
+}
+
+extern void r2c_free(r2c_matcher *matcher) {
+    if (matcher != NULL) {
+        dlclose(matcher->handle);
+        free(matcher);
+    }
+}
+
+extern ptrdiff_t r2c_match_n(const r2c_matcher *matcher, const unsigned char *buf, size_t len) {
+    return matcher->match_n(buf, len);
+}
+
+extern bool r2c_search(const r2c_matcher *matcher, const unsigned char *buf, size_t len,
+                       size_t *start, size_t *end) {
+    return matcher->search(buf, len, start, end);
+}
+
+extern int r2c_captures(const r2c_matcher *matcher) {
+    return matcher->captures;
+}
+
+extern ptrdiff_t r2c_match_captures(const r2c_matcher *matcher, const unsigned char *buf,
+                                    size_t len, size_t *starts, size_t *ends) {
+    if (matcher->match_captures == NULL) {
+        return -1;
+    }
+    return matcher->match_captures(buf, len, starts, ends);
+}
@@ -0,0 +1,46 @@
+#ifndef R2C_H_
+#define R2C_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Compiling patterns at run time, without the regex-to-c binary: the
+// generator is linked in from target/libr2c.a, its output is built into a
+// shared object with the system C compiler ($R2C_CC, or cc) and dlopen()ed.
+//
+// Shared objects are cached in $R2C_CACHE_DIR, or regex-to-c/ under
+// $XDG_CACHE_HOME or ~/.cache, named by a hash of the pattern, the flags,
+// the compiler and the generator sources. A pattern that is already in the
+// cache only costs a dlopen(). Link with -ldl on older C libraries.
+
+// default: the backend regex-to-c picks without -b
+#define R2C_DFA         1   // -b dfa
+#define R2C_TABLE       2   // -b dfa -e table
+#define R2C_LAZY        4   // -b lazy
+#define R2C_CAPTURES    8   // -c, for r2c_match_captures()
+
+typedef struct r2c_matcher r2c_matcher;
+
+// NULL when the pattern is malformed or does not compile; the reason is
+// printed to stderr. Not thread safe.
+extern r2c_matcher *r2c_compile(const char *pattern, int flags);
+extern void r2c_free(r2c_matcher *matcher);
+
+// Writes the C code r2c_compile() would build to `out`, without the cache
+// or a compiler. Runs in the calling thread and keeps no state between
+// calls, so threads can generate patterns at the same time; a malformed
+// pattern aborts the process, r2c_compile() is the safe way to try one.
+extern void r2c_generate(const char *pattern, int flags, FILE *out);
+
+// the generated match_n(), search() and match_captures() of the pattern
+extern ptrdiff_t r2c_match_n(const r2c_matcher *matcher, const unsigned char *buf, size_t len);
+extern bool r2c_search(const r2c_matcher *matcher, const unsigned char *buf, size_t len,
+                       size_t *start, size_t *end);
+// MATCH_CAPTURES of the pattern, 0 if it was compiled without R2C_CAPTURES
+extern int r2c_captures(const r2c_matcher *matcher);
+// -1 when the pattern was compiled without R2C_CAPTURES
+extern ptrdiff_t r2c_match_captures(const r2c_matcher *matcher, const unsigned char *buf,
+                                    size_t len, size_t *starts, size_t *ends);
+
+#endif
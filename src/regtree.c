@@ -1,175 +1,192 @@
 #include <stdbool.h>
 #include <string.h>
-#include <assert.h>
 
 #include "token.h"
 #include "xutils.h"
+#include "arena.h"
 #include "regtree.h"
+#include "stats.h"
+
+// Children are collected on a scratch stack while their parent is parsed
+// and copied into the arena in one go once the parent is complete, so
+// every node costs O(1) amortized no matter how wide the tree is.
+typedef struct {
+    Lexer lexer;
+    Arena *arena;
+    void **stack;
+    int size, capacity;
+} Parser;
+
+static RegexNode *parse_regex(Parser *parser);
+
+static void push_child(Parser *parser, void *child) {
+    if (parser->size == parser->capacity) {
+        parser->capacity = parser->capacity ? parser->capacity * 2 : 64;
+        parser->stack = xrealloc(parser->stack, parser->capacity * sizeof(void *));
+    }
+    parser->stack[parser->size++] = child;
+}
 
-static RegexNode *parse_regex(void);
+static void *pop_children(Parser *parser, int base) {
+    int count = parser->size - base;
+    void *result = arena_alloc(parser->arena, count * sizeof(void *));
+    memcpy(result, parser->stack + base, count * sizeof(void *));
+    parser->size = base;
+    return result;
+}
 
-static AtomNode *parse_atom(void) {
-    AtomNode *result = xmalloc(sizeof(AtomNode));
+static int span_len(const char *start, const char *end) {
+    return end - start;
+}
 
-    Token lookahead = get_token();
+static AtomNode *parse_atom(Parser *parser) {
+    AtomNode *result = arena_alloc(parser->arena, sizeof(AtomNode));
+
+    Token lookahead = get_token(&parser->lexer);
+    result->anno_start = lookahead.anno_start;
 
     if (lookahead.type == T_META) {
         if (lookahead.metachar == '(') {
             result->is_simple_atom = false;
-            result->regex = parse_regex();
-            result->annotation = xstrdup("(");
-            result->annotation = xstrcat(result->annotation, xstrdup(result->regex->annotation));
-            result->annotation = xstrcat(result->annotation, xstrdup(")"));
+            result->regex = parse_regex(parser);
+            Token close = get_token(&parser->lexer);
+            if (close.type != T_META || close.metachar != ')') {
+                panic("unmatched '('");
+            }
+            result->anno_len = span_len(result->anno_start, close.anno_start + close.anno_len);
         } else {
             panic("illegal regex");
         }
     } else if (lookahead.type == T_CHARSET) {
         result->is_simple_atom = true;
-        memset(&result->allowed, 0, sizeof(bool) * 256);
-        for (int i = 0; i < 256; ++i) {
-            if (lookahead.allowed[i]) {
-                result->allowed[i] = true;
-            }
-        }
-        result->annotation = get_token_annotation(lookahead);
+        result->allowed = lookahead.allowed;
+        result->anno_len = lookahead.anno_len;
     } else {
         panic("illegal regex");
     }
 
-    assert(result->annotation != NULL);
     return result;
 }
 
-static PieceNode *parse_piece(void) {
-    PieceNode *result = xmalloc(sizeof(PieceNode));
-    result->atom = parse_atom();
+static PieceNode *parse_piece(Parser *parser) {
+    PieceNode *result = arena_alloc(parser->arena, sizeof(PieceNode));
+    result->atom = parse_atom(parser);
     result->min = 1;
     result->max = 1;
-    result->annotation = xstrdup(result->atom->annotation);
-
-    Token lookahead = get_token();
-    if (lookahead.type == T_META) {
-        if (lookahead.metachar == '*') {
-            result->min = 0;
-            result->max = -1;
-            result->annotation = xstrcat(result->annotation, get_token_annotation(lookahead));
-        } else if (lookahead.metachar == '+') {
-            result->min = 1;
-            result->max = -1;
-            result->annotation = xstrcat(result->annotation, get_token_annotation(lookahead));
-        } else if (lookahead.metachar == '?') {
-            result->min = 0;
-            result->max = 1;
-            result->annotation = xstrcat(result->annotation, get_token_annotation(lookahead));
-        } else {
-            unget_token(lookahead);
-        }
-    } else if (lookahead.type == T_BOUND){
+    result->anno_start = result->atom->anno_start;
+    result->anno_len = result->atom->anno_len;
+
+    Token lookahead = get_token(&parser->lexer);
+    bool quantified = true;
+    if (lookahead.type == T_META && lookahead.metachar == '*') {
+        result->min = 0;
+        result->max = -1;
+    } else if (lookahead.type == T_META && lookahead.metachar == '+') {
+        result->min = 1;
+        result->max = -1;
+    } else if (lookahead.type == T_META && lookahead.metachar == '?') {
+        result->min = 0;
+        result->max = 1;
+    } else if (lookahead.type == T_BOUND) {
         result->min = lookahead.bound[0];
         result->max = lookahead.bound[1];
-        result->annotation = xstrcat(result->annotation, get_token_annotation(lookahead));
     } else {
-        unget_token(lookahead);
+        quantified = false;
+        unget_token(&parser->lexer, lookahead);
+    }
+
+    if (quantified) {
+        result->anno_len = span_len(result->anno_start, lookahead.anno_start + lookahead.anno_len);
     }
 
-    assert(result->annotation != NULL);
     return result;
 }
 
-static BranchNode *parse_branch(void) {
-    BranchNode *result = xmalloc(sizeof(BranchNode));
-    result->size = 0;
-    result->pieces = NULL;
-    result->annotation = NULL;
+static BranchNode *parse_branch(Parser *parser) {
+    BranchNode *result = arena_alloc(parser->arena, sizeof(BranchNode));
+    const char *end = NULL;
+    int base = parser->size;
 
     for (;;) {
-        Token lookahead = get_token();
+        Token lookahead = get_token(&parser->lexer);
+        unget_token(&parser->lexer, lookahead);
+
+        if (end == NULL) {
+            result->anno_start = lookahead.anno_start;
+            end = lookahead.anno_start;
+        }
 
         if (lookahead.type == T_END
                 || (lookahead.type == T_META && lookahead.metachar == ')')
                 || (lookahead.type == T_META && lookahead.metachar == '|')) {
-            unget_token(lookahead);
             break;
         }
 
-        unget_token(lookahead);
-        result->pieces = xrealloc(result->pieces, (result->size + 1) * sizeof(PieceNode*));
-        result->pieces[result->size] = parse_piece();
-        result->annotation = xstrcat(result->annotation, xstrdup(result->pieces[result->size]->annotation));
-
-        result->size += 1;
+        PieceNode *piece = parse_piece(parser);
+        push_child(parser, piece);
+        end = piece->anno_start + piece->anno_len;
     }
 
-    assert(result->annotation != NULL);
+    result->size = parser->size - base;
+    result->pieces = pop_children(parser, base);
+    result->anno_len = span_len(result->anno_start, end);
     return result;
 }
 
-static RegexNode *parse_regex(void) {
-    RegexNode *result = xmalloc(sizeof(RegexNode));
-    int first = true;
-
-    result->size = 0;
-    result->branches = NULL;
-    result->annotation = NULL;
+// stops in front of the `)` or the end of the pattern, without taking it
+static RegexNode *parse_regex(Parser *parser) {
+    RegexNode *result = arena_alloc(parser->arena, sizeof(RegexNode));
+    int base = parser->size;
 
     for (;;) {
-        Token lookahead = get_token();
+        BranchNode *branch = parse_branch(parser);
+        push_child(parser, branch);
 
-        if (lookahead.type == T_END
-                || (lookahead.type == T_META && lookahead.metachar == ')')) {
+        Token lookahead = get_token(&parser->lexer);
+        if (lookahead.type != T_META || lookahead.metachar != '|') {
+            unget_token(&parser->lexer, lookahead);
             break;
         }
-
-        if (first) {
-            unget_token(lookahead);
-            result->branches = xrealloc(result->branches, (result->size + 1) * sizeof(BranchNode*));
-            result->branches[result->size] = parse_branch();
-            result->annotation = xstrcat(result->annotation, xstrdup(result->branches[result->size]->annotation));
-            result->size += 1;
-            first = false;
-        } else {
-            if (lookahead.type == T_META && lookahead.metachar == '|') {
-                result->branches = xrealloc(result->branches, (result->size + 1) * sizeof(BranchNode*));
-                result->branches[result->size] = parse_branch();
-                result->annotation = xstrcat(result->annotation, xstrdup("|"));
-                result->annotation = xstrcat(result->annotation, xstrdup(result->branches[result->size]->annotation));
-                result->size += 1;
-            } else {
-                panic("illegal regex");
-            }
-        }
     }
 
-    assert(result->annotation != NULL);
-    return result;
-}
+    result->size = parser->size - base;
+    result->branches = pop_children(parser, base);
 
-extern RegexNode *regtree_from_str(char *str) {
-    set_pattern_str(str);
-    return parse_regex();
+    BranchNode *first = result->branches[0];
+    BranchNode *last = result->branches[result->size - 1];
+    result->anno_start = first->anno_start;
+    result->anno_len = span_len(first->anno_start, last->anno_start + last->anno_len);
+    return result;
 }
 
-extern void regtree_drop(RegexNode *regex) {
-    for (int i = 0; i < regex->size; ++i) {
-        BranchNode *branch = regex->branches[i];
-        for (int j = 0; j < branch->size; ++j) {
-            PieceNode *piece = branch->pieces[j];
-
-            if (!piece->atom->is_simple_atom) {
-                regtree_drop(piece->atom->regex);
-            }
+extern RegexTree *regtree_from_str(const char *str) {
+    stats_begin("parse");
+    RegexTree *result = xmalloc(sizeof(RegexTree));
+    arena_init(&result->arena);
+
+    size_t len = strlen(str);
+    char *pattern = arena_alloc(&result->arena, len + 1);
+    memcpy(pattern, str, len + 1);
+    result->pattern = pattern;
+
+    Parser parser;
+    parser.arena = &result->arena;
+    parser.stack = NULL;
+    parser.size = 0;
+    parser.capacity = 0;
+
+    lexer_init(&parser.lexer, pattern);
+    result->root = parse_regex(&parser);
+    if (get_token(&parser.lexer).type != T_END) {
+        panic("unmatched ')'");
+    }
 
-            free(piece->atom->annotation);
-            free(piece->atom);
+    free(parser.stack);
+    stats_end();
+    return result;
+}
 
-            free(piece->annotation);
-            free(piece);
-        }
-        free(branch->annotation);
-        free(branch->pieces);
-        free(branch);
-    }
-    free(regex->annotation);
-    free(regex->branches);
-    free(regex);
+extern void regtree_drop(RegexTree *tree) {
+    arena_drop(&tree->arena);
+    free(tree);
 }
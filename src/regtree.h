@@ -1,36 +1,54 @@
 #ifndef REGTREE_H_
 #define REGTREE_H_
 
+#include <stdbool.h>
+
+#include "arena.h"
+#include "charset.h"
+
+// Every node is allocated from the tree's arena. Annotations are spans of
+// the tree's own copy of the pattern, so they are not NUL terminated; print
+// them with "%.*s".
 typedef struct BranchNode BranchNode;
 
 typedef struct RegexNode {
-    char *annotation;
+    const char *anno_start;
+    int anno_len;
     BranchNode **branches;
     int size;
 } RegexNode;
 
 typedef struct {
-    char *annotation;
+    const char *anno_start;
+    int anno_len;
     bool is_simple_atom;
     union {
         RegexNode *regex;
-        bool allowed[256];
+        Charset allowed;
     };
 } AtomNode;
 
 typedef struct {
-    char *annotation;
+    const char *anno_start;
+    int anno_len;
     AtomNode *atom;
     int min, max;
 } PieceNode;
 
 struct BranchNode {
-    char *annotation;
+    const char *anno_start;
+    int anno_len;
     PieceNode **pieces;
     int size;
 };
 
-extern void regtree_drop(RegexNode *regex);
-extern RegexNode *regtree_from_str(char *str);
+typedef struct {
+    RegexNode *root;
+    const char *pattern;
+    Arena arena;
+} RegexTree;
+
+extern void regtree_drop(RegexTree *tree);
+extern RegexTree *regtree_from_str(const char *str);
 
 #endif
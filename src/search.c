@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "regtree.h"
+#include "search.h"
+
+static bool regex_nullable(RegexNode *regex);
+
+static bool piece_nullable(PieceNode *piece) {
+    if (piece->min == 0) {
+        return true;
+    }
+    return !piece->atom->is_simple_atom && regex_nullable(piece->atom->regex);
+}
+
+static bool branch_nullable(BranchNode *branch) {
+    for (int i = 0; i < branch->size; ++i) {
+        if (!piece_nullable(branch->pieces[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool regex_nullable(RegexNode *regex) {
+    for (int i = 0; i < regex->size; ++i) {
+        if (branch_nullable(regex->branches[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void regex_first(RegexNode *regex, bool *first) {
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        for (int j = 0; j < branch->size; ++j) {
+            PieceNode *piece = branch->pieces[j];
+            if (piece->max != 0) {
+                if (piece->atom->is_simple_atom) {
+                    for (int c = 0; c < 256; ++c) {
+                        first[c] = first[c] || charset_has(&piece->atom->allowed, c);
+                    }
+                } else {
+                    regex_first(piece->atom->regex, first);
+                }
+            }
+            if (!piece_nullable(piece)) {
+                break;
+            }
+        }
+    }
+}
+
+// width of every string the regex matches, -1 if it varies
+static int regex_width(RegexNode *regex) {
+    int width = -1;
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        int branch_width = 0;
+        for (int j = 0; j < branch->size && branch_width != -1; ++j) {
+            PieceNode *piece = branch->pieces[j];
+            int atom_width = piece->atom->is_simple_atom ? 1 : regex_width(piece->atom->regex);
+            if (piece->min != piece->max || atom_width == -1) {
+                branch_width = -1;
+            } else {
+                branch_width += piece->min * atom_width;
+            }
+        }
+        if (branch_width == -1 || (i > 0 && branch_width != width)) {
+            return -1;
+        }
+        width = branch_width;
+    }
+    return width;
+}
+
+static int single_byte(AtomNode *atom) {
+    int result = -1;
+    for (int c = 0; c < 256; ++c) {
+        if (charset_has(&atom->allowed, c)) {
+            if (result != -1) {
+                return -1;
+            }
+            result = c;
+        }
+    }
+    return result;
+}
+
+// rough frequency of a byte in logs and text, higher is more common
+static int commonness(int c) {
+    if (c == ' ' || (c != '\0' && strchr("etaoinsrhl", c) != NULL)) {
+        return 5;
+    } else if (c >= 'a' && c <= 'z') {
+        return 4;
+    } else if ((c >= '0' && c <= '9') || c == '\n') {
+        return 3;
+    } else if (c >= 'A' && c <= 'Z') {
+        return 2;
+    } else if (c >= 0x20 && c < 0x7f) {
+        return 1;
+    }
+    return 0;
+}
+
+// Walks the pieces every match goes through, collecting runs of single
+// byte pieces into literals and keeping the best one.
+typedef struct {
+    int offset;     // width of everything before the current piece, or -1
+    unsigned char run[SEARCH_LITERAL_MAX];
+    int run_len;
+    int run_offset;
+    SearchInfo *info;
+} LiteralScan;
+
+static void close_run(LiteralScan *scan) {
+    SearchInfo *info = scan->info;
+    if (scan->run_len > 0) {
+        bool fixed = scan->run_offset != -1;
+        bool best_fixed = info->offset != -1;
+        // a literal at a known offset pins down the match start, so it wins
+        // over any literal at a varying one
+        if (info->literal_len == 0 || (fixed && !best_fixed)
+                || (fixed == best_fixed && scan->run_len > info->literal_len)) {
+            memcpy(info->literal, scan->run, scan->run_len);
+            info->literal_len = scan->run_len;
+            info->offset = scan->run_offset;
+        }
+    }
+    scan->run_len = 0;
+}
+
+static void scan_branch(LiteralScan *scan, BranchNode *branch) {
+    for (int i = 0; i < branch->size; ++i) {
+        PieceNode *piece = branch->pieces[i];
+        AtomNode *atom = piece->atom;
+        int byte = atom->is_simple_atom ? single_byte(atom) : -1;
+
+        if (byte != -1 && piece->min > 0) {
+            if (scan->run_len == 0) {
+                scan->run_offset = scan->offset;
+            }
+            for (int j = 0; j < piece->min && scan->run_len < SEARCH_LITERAL_MAX; ++j) {
+                scan->run[scan->run_len++] = byte;
+            }
+            if (piece->max != piece->min || scan->run_len == SEARCH_LITERAL_MAX) {
+                close_run(scan);
+            }
+        } else if (!atom->is_simple_atom && atom->regex->size == 1
+                && piece->min == 1 && piece->max == 1) {
+            // a plain group like `(abc)` is transparent
+            scan_branch(scan, atom->regex->branches[0]);
+            continue;
+        } else {
+            close_run(scan);
+        }
+
+        int width = atom->is_simple_atom ? 1 : regex_width(atom->regex);
+        if (scan->offset == -1 || width == -1 || piece->min != piece->max) {
+            scan->offset = -1;
+        } else {
+            scan->offset += piece->min * width;
+        }
+    }
+}
+
+extern void search_info_from_regtree(RegexNode *regex, SearchInfo *info) {
+    memset(info, 0, sizeof(SearchInfo));
+    info->nullable = regex_nullable(regex);
+    regex_first(regex, info->first);
+    info->offset = -1;
+
+    if (regex->size == 1) {
+        LiteralScan scan;
+        scan.offset = 0;
+        scan.run_len = 0;
+        scan.run_offset = 0;
+        scan.info = info;
+        scan_branch(&scan, regex->branches[0]);
+        close_run(&scan);
+    }
+
+    for (int i = 1; i < info->literal_len; ++i) {
+        if (commonness(info->literal[i]) < commonness(info->literal[info->rare])) {
+            info->rare = i;
+        }
+    }
+}
+
+static void emit_literal(SearchInfo *info, FILE *out) {
+    fprintf(out, "\nstatic const unsigned char search_literal[%d] = {", info->literal_len);
+    for (int i = 0; i < info->literal_len; ++i) {
+        fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", info->literal[i]);
+    }
+    fprintf(out, "\n};\n");
+
+    fprintf(out, "\n\
+// first occurrence of search_literal starting at or after `from`\n\
+static const unsigned char *search_find(const unsigned char *buf, size_t len, size_t from) {\n\
+    while (from + %d <= len) {\n\
+        const unsigned char *hit = memchr(buf + from + %d, search_literal[%d], len - %d + 1 - from);\n\
+        if (hit == NULL) {\n\
+            return NULL;\n\
+        }\n\
+        const unsigned char *lit = hit - %d;\n\
+        if (memcmp(lit, search_literal, %d) == 0) {\n\
+            return lit;\n\
+        }\n\
+        from = lit - buf + 1;\n\
+    }\n\
+    return NULL;\n\
+}\n", info->literal_len, info->rare, info->rare, info->literal_len,
+        info->rare, info->literal_len);
+}
+
+static void emit_first_filter(SearchInfo *info, FILE *out) {
+    int count = 0, byte = -1;
+    for (int c = 0; c < 256; ++c) {
+        if (info->first[c]) {
+            count += 1;
+            byte = c;
+        }
+    }
+
+    if (count == 1) {
+        fprintf(out, "\
+        const unsigned char *next = memchr(buf + s, %d, len - s);\n\
+        if (next == NULL) {\n\
+            return 0;\n\
+        }\n\
+        s = next - buf;\n", byte);
+    } else if (count < 256) {
+        fprintf(out, "\
+        if (!search_first[buf[s]]) {\n\
+            continue;\n\
+        }\n");
+    }
+}
+
+extern void emit_search(RegexNode *regex, FILE *out) {
+    SearchInfo info;
+    search_info_from_regtree(regex, &info);
+
+    if (info.nullable) {
+        // the leftmost match is always the one at offset 0
+        fprintf(out, "\n\
+int search(const unsigned char *buf, size_t len, size_t *start, size_t *end) {\n\
+    *start = 0;\n\
+    *end = match_n(buf, len);\n\
+    return 1;\n\
+}\n");
+        return;
+    }
+
+    if (info.literal_len > 0) {
+        emit_literal(&info, out);
+    }
+
+    if (info.offset != -1) {
+        // every candidate start comes straight from a literal hit
+        fprintf(out, "\n\
+int search(const unsigned char *buf, size_t len, size_t *start, size_t *end) {\n\
+    size_t from = %d;\n\
+    const unsigned char *lit;\n\
+    while ((lit = search_find(buf, len, from)) != NULL) {\n\
+        size_t s = lit - buf - %d;\n\
+        ptrdiff_t n = match_n(buf + s, len - s);\n\
+        if (n >= 0) {\n\
+            *start = s;\n\
+            *end = s + n;\n\
+            return 1;\n\
+        }\n\
+        from = lit - buf + 1;\n\
+    }\n\
+    return 0;\n\
+}\n", info.offset, info.offset);
+        return;
+    }
+
+    int count = 0;
+    for (int c = 0; c < 256; ++c) {
+        count += info.first[c];
+    }
+    if (count == 0) {
+        // no byte can start a match, like [^[:ascii:]]+
+        fprintf(out, "\n\
+int search(const unsigned char *buf, size_t len, size_t *start, size_t *end) {\n\
+    (void)buf, (void)len, (void)start, (void)end;\n\
+    return 0;\n\
+}\n");
+        return;
+    }
+    if (count > 1 && count < 256) {
+        fprintf(out, "\nstatic const unsigned char search_first[256] = {");
+        for (int c = 0; c < 256; ++c) {
+            fprintf(out, "%s%d,", c % 32 == 0 ? "\n    " : " ", info.first[c]);
+        }
+        fprintf(out, "\n};\n");
+    }
+
+    fprintf(out, "\n\
+int search(const unsigned char *buf, size_t len, size_t *start, size_t *end) {\n");
+    if (info.literal_len > 0) {
+        fprintf(out, "    const unsigned char *lit = NULL;\n");
+    }
+    fprintf(out, "    for (size_t s = 0; s < len; ++s) {\n");
+    emit_first_filter(&info, out);
+    if (info.literal_len > 0) {
+        // no match can start after the last occurrence of the literal
+        fprintf(out, "\
+        if (lit == NULL || (size_t)(lit - buf) < s) {\n\
+            lit = search_find(buf, len, s);\n\
+            if (lit == NULL) {\n\
+                return 0;\n\
+            }\n\
+        }\n");
+    }
+    fprintf(out, "\
+        ptrdiff_t n = match_n(buf + s, len - s);\n\
+        if (n >= 0) {\n\
+            *start = s;\n\
+            *end = s + n;\n\
+            return 1;\n\
+        }\n\
+    }\n\
+    return 0;\n\
+}\n");
+}
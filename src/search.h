@@ -0,0 +1,28 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "regtree.h"
+
+#define SEARCH_LITERAL_MAX 32
+
+// What the regex tree tells us about where a match can start.
+typedef struct {
+    bool nullable;
+    bool first[256];    // bytes a non-empty match can start with
+
+    // A literal every match contains, `offset` bytes after the start of the
+    // match, or at a varying distance when `offset` is -1. `rare` indexes
+    // the byte of the literal that is least likely to show up in text.
+    unsigned char literal[SEARCH_LITERAL_MAX];
+    int literal_len;
+    int offset;
+    int rare;
+} SearchInfo;
+
+extern void search_info_from_regtree(RegexNode *regex, SearchInfo *info);
+extern void emit_search(RegexNode *regex, FILE *out);
+
+#endif
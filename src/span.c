@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "charset.h"
+#include "span.h"
+
+// Run-length kernels: span%03d(p, n) returns how many leading bytes of
+// p[0..n) are in one charset. The SIMD versions compare 16 or 32 bytes at a
+// time and find the first byte outside the set with movemask + ctz.
+//
+// Sets made of a few byte ranges (or whose complement is) are tested with
+// one unsigned range compare per range, which SSE2 can do. Other sets use
+// Muła's nibble lookup, which needs pshufb and so only has an AVX2 version.
+
+#define SPAN_MAX_RANGES 4
+
+extern int charset_ranges(const Charset *allowed, bool want, int *lo, int *hi) {
+    int size = 0;
+    for (int c = 0; c < 256; ++c) {
+        bool in = charset_has(allowed, c) == want;
+        if (in && (c == 0 || charset_has(allowed, c - 1) != want)) {
+            lo[size] = c;
+            size += 1;
+        }
+        if (in && (c == 255 || charset_has(allowed, c + 1) != want)) {
+            hi[size - 1] = c;
+        }
+    }
+    return size;
+}
+
+extern void emit_span_prologue(FILE *out) {
+    fprintf(out, "\n\
+#if !defined(R2C_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__)\n\
+#define SPAN_SSE2 1\n\
+#include <emmintrin.h>\n\
+#endif\n\
+#if !defined(R2C_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))\n\
+#define SPAN_AVX2 1\n\
+#include <immintrin.h>\n\
+\n\
+__attribute__((unused))\n\
+static int span_has_avx2(void) {\n\
+    static int cached = -1;\n\
+    if (cached < 0) {\n\
+        __builtin_cpu_init();\n\
+        cached = __builtin_cpu_supports(\"avx2\") ? 1 : 0;\n\
+    }\n\
+    return cached;\n\
+}\n\
+#endif\n");
+}
+
+extern void emit_range_test(int size, const int *lo, const int *hi, bool want, FILE *out) {
+    fprintf(out, "%s(", want ? "" : "!");
+    for (int i = 0; i < size; ++i) {
+        if (lo[i] == hi[i]) {
+            fprintf(out, "%sc == %d", i ? " || " : "", lo[i]);
+        } else {
+            fprintf(out, "%s(unsigned char)(c - %d) <= %d", i ? " || " : "", lo[i], hi[i] - lo[i]);
+        }
+    }
+    fprintf(out, ")");
+}
+
+// expression that is nonzero when the byte `c` is in the set
+static void emit_scalar_test(int id, int size, int *lo, int *hi, bool want, FILE *out) {
+    if (size > SPAN_MAX_RANGES) {
+        fprintf(out, "span%03d_table[c]", id);
+    } else {
+        emit_range_test(size, lo, hi, want, out);
+    }
+}
+
+// sets `m` to the lanes of `x` that are in the ranges
+static void emit_range_mask(int bits, int size, int *lo, int *hi, FILE *out) {
+    const char *v = bits == 128 ? "_mm" : "_mm256";
+    for (int i = 0; i < size; ++i) {
+        if (i == 0) {
+            fprintf(out, "        __m%di m = ", bits);
+        } else {
+            fprintf(out, "        m = %s_or_si%d(m, ", v, bits);
+        }
+        if (lo[i] == hi[i]) {
+            fprintf(out, "%s_cmpeq_epi8(x, %s_set1_epi8((char)%d))", v, v, lo[i]);
+        } else {
+            // unsigned x - lo <= hi - lo, as min(t, k) == t
+            fprintf(out, "%s_cmpeq_epi8(%s_min_epu8(%s_sub_epi8(x, %s_set1_epi8((char)%d)), %s_set1_epi8((char)%d)), %s_sub_epi8(x, %s_set1_epi8((char)%d)))",
+                    v, v, v, v, lo[i], v, hi[i] - lo[i], v, v, lo[i]);
+        }
+        fprintf(out, "%s;\n", i == 0 ? "" : ")");
+    }
+}
+
+static void emit_nibble_tables(int id, const Charset *allowed, FILE *out) {
+    fprintf(out, "static const unsigned char span%03d_nibbles[2][16] = {\n", id);
+    for (int half = 0; half < 2; ++half) {
+        fprintf(out, "    {");
+        for (int low = 0; low < 16; ++low) {
+            int bits = 0;
+            for (int high = 0; high < 8; ++high) {
+                if (charset_has(allowed, ((high + half * 8) << 4) | low)) {
+                    bits |= 1 << high;
+                }
+            }
+            fprintf(out, " %d,", bits);
+        }
+        fprintf(out, " },\n");
+    }
+    fprintf(out, "};\n");
+}
+
+extern void emit_span(int id, const Charset *allowed, const char *anno_start, int anno_len, FILE *out) {
+    int lo[256], hi[256], clo[256], chi[256];
+    int size = charset_ranges(allowed, true, lo, hi);
+    int csize = charset_ranges(allowed, false, clo, chi);
+    bool want = size <= csize;
+    int *rlo = want ? lo : clo, *rhi = want ? hi : chi;
+    int rsize = want ? size : csize;
+
+    fprintf(out, "\n// %.*s\n", anno_len, anno_start);
+
+    // a full or an empty set has no ranges to compare against
+    if (size == 0 || csize == 0) {
+        fprintf(out, "\
+static size_t span%03d(const unsigned char *p, size_t n) {\n\
+    (void)p;\n\
+    return %s;\n\
+}\n", id, size == 0 ? "0" : "n");
+        return;
+    }
+
+    if (rsize > SPAN_MAX_RANGES) {
+        fprintf(out, "static const unsigned char span%03d_table[256] = {", id);
+        for (int c = 0; c < 256; ++c) {
+            fprintf(out, "%s%d,", c % 32 == 0 ? "\n    " : " ", charset_has(allowed, c));
+        }
+        fprintf(out, "\n};\n\n");
+    }
+
+    fprintf(out, "\
+static size_t span%03d_scalar(const unsigned char *p, size_t n) {\n\
+    size_t i = 0;\n\
+    for (; i < n; ++i) {\n\
+        unsigned char c = p[i];\n\
+        if (!", id);
+    emit_scalar_test(id, rsize, rlo, rhi, want, out);
+    fprintf(out, ") {\n\
+            break;\n\
+        }\n\
+    }\n\
+    return i;\n\
+}\n");
+
+    // `m` holds the lanes in the set when `want`, else the lanes outside it
+    const char *stop128 = want ? "(unsigned)_mm_movemask_epi8(m) ^ 0xffffu" : "(unsigned)_mm_movemask_epi8(m)";
+    const char *stop256 = want ? "(unsigned)_mm256_movemask_epi8(m) ^ 0xffffffffu" : "(unsigned)_mm256_movemask_epi8(m)";
+
+    if (rsize <= SPAN_MAX_RANGES) {
+        fprintf(out, "\n\
+#ifdef SPAN_SSE2\n\
+static size_t span%03d_sse2(const unsigned char *p, size_t n) {\n\
+    size_t i = 0;\n\
+    for (; i + 16 <= n; i += 16) {\n\
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + i));\n", id);
+        emit_range_mask(128, rsize, rlo, rhi, out);
+        fprintf(out, "\
+        unsigned stop = %s;\n\
+        if (stop != 0) {\n\
+            return i + __builtin_ctz(stop);\n\
+        }\n\
+    }\n\
+    return i + span%03d_scalar(p + i, n - i);\n\
+}\n\
+#endif\n", stop128, id);
+    }
+
+    fprintf(out, "\n#ifdef SPAN_AVX2\n");
+    if (rsize > SPAN_MAX_RANGES) {
+        emit_nibble_tables(id, allowed, out);
+    }
+    fprintf(out, "\
+__attribute__((target(\"avx2\")))\n\
+static size_t span%03d_avx2(const unsigned char *p, size_t n) {\n", id);
+    if (rsize > SPAN_MAX_RANGES) {
+        fprintf(out, "\
+    const __m256i low_rows = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)span%03d_nibbles[0]));\n\
+    const __m256i high_rows = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)span%03d_nibbles[1]));\n\
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,\n\
+            1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);\n", id, id);
+    }
+    fprintf(out, "\
+    size_t i = 0;\n\
+    for (; i + 32 <= n; i += 32) {\n\
+        __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));\n");
+    if (rsize > SPAN_MAX_RANGES) {
+        fprintf(out, "\
+        __m256i low = _mm256_and_si256(x, _mm256_set1_epi8(0x0f));\n\
+        __m256i high = _mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi8(0x0f));\n\
+        __m256i upper = _mm256_cmpgt_epi8(high, _mm256_set1_epi8(7));\n\
+        __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(low_rows, low), _mm256_shuffle_epi8(high_rows, low), upper);\n\
+        __m256i bit = _mm256_shuffle_epi8(bits, high);\n\
+        __m256i m = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit);\n\
+        unsigned stop = %s;\n", "(unsigned)_mm256_movemask_epi8(m) ^ 0xffffffffu");
+    } else {
+        emit_range_mask(256, rsize, rlo, rhi, out);
+        fprintf(out, "        unsigned stop = %s;\n", stop256);
+    }
+    fprintf(out, "\
+        if (stop != 0) {\n\
+            return i + __builtin_ctz(stop);\n\
+        }\n\
+    }\n\
+    return i + span%03d_scalar(p + i, n - i);\n\
+}\n\
+#endif\n", id);
+
+    fprintf(out, "\n\
+static size_t span%03d(const unsigned char *p, size_t n) {\n\
+#ifdef SPAN_AVX2\n\
+    if (span_has_avx2()) {\n\
+        return span%03d_avx2(p, n);\n\
+    }\n\
+#endif\n", id, id);
+    if (rsize <= SPAN_MAX_RANGES) {
+        fprintf(out, "\
+#ifdef SPAN_SSE2\n\
+    return span%03d_sse2(p, n);\n\
+#endif\n", id);
+    }
+    fprintf(out, "\
+    return span%03d_scalar(p, n);\n\
+}\n", id);
+}
@@ -0,0 +1,18 @@
+#ifndef SPAN_H_
+#define SPAN_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "charset.h"
+
+// the runs of bytes in the set, or outside it when !want; lo and hi need
+// room for 128 runs
+extern int charset_ranges(const Charset *allowed, bool want, int *lo, int *hi);
+// an expression on the byte `c`, nonzero when it is in one of the runs, or
+// in none of them when !want
+extern void emit_range_test(int size, const int *lo, const int *hi, bool want, FILE *out);
+extern void emit_span_prologue(FILE *out);
+extern void emit_span(int id, const Charset *allowed, const char *anno_start, int anno_len, FILE *out);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "xutils.h"
+#include "regtree.h"
+#include "stats.h"
+
+#define STATS_MAX_DEPTH 16
+
+typedef struct {
+    const char *name;
+    long calls;
+    long long self_ns;
+    long emitted_bytes;
+    long peak_rss_kb;   // the process' high water mark when the phase last ended
+} Phase;
+
+typedef struct {
+    const char *name;
+    long value;
+} Counter;
+
+typedef struct {
+    Phase *phase;
+    long long start_ns;     // when stats_begin() was entered
+    long long inner_ns;     // when stats_begin() returned
+    long long child_ns;     // spent in nested phases, bookkeeping included
+    long start_bytes;
+    long child_bytes;
+} Frame;
+
+// per thread, so that patterns generated on other threads neither race
+// with nor show up in the numbers
+_Thread_local bool stats_enabled = false;
+
+static _Thread_local long long start_ns;
+static _Thread_local FILE *output = NULL;
+
+static _Thread_local Phase *phases = NULL;
+static _Thread_local int phase_size = 0, phase_capacity = 0;
+static _Thread_local Counter *counters = NULL;
+static _Thread_local int counter_size = 0, counter_capacity = 0;
+static _Thread_local Frame stack[STATS_MAX_DEPTH];
+static _Thread_local int depth = 0;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+static long output_pos(void) {
+    return output != NULL ? ftell(output) : 0;
+}
+
+static Phase *find_phase(const char *name) {
+    for (int i = 0; i < phase_size; ++i) {
+        if (!strcmp(phases[i].name, name)) {
+            return &phases[i];
+        }
+    }
+    if (phase_size == phase_capacity) {
+        phase_capacity = phase_capacity ? phase_capacity * 2 : 16;
+        phases = xrealloc(phases, phase_capacity * sizeof(Phase));
+    }
+    Phase *phase = &phases[phase_size++];
+    phase->name = name;
+    phase->calls = 0;
+    phase->self_ns = 0;
+    phase->emitted_bytes = 0;
+    phase->peak_rss_kb = 0;
+    return phase;
+}
+
+extern void stats_init(void) {
+    stats_enabled = true;
+    start_ns = now_ns();
+}
+
+extern void stats_begin(const char *name) {
+    if (!stats_enabled) {
+        return;
+    }
+    long long t = now_ns();
+    if (depth == STATS_MAX_DEPTH) {
+        panic("stats phases nested too deep");
+    }
+    Frame *frame = &stack[depth++];
+    frame->phase = find_phase(name);
+    frame->start_ns = t;
+    frame->child_ns = 0;
+    frame->start_bytes = output_pos();
+    frame->child_bytes = 0;
+    frame->inner_ns = now_ns();
+}
+
+extern void stats_end(void) {
+    if (!stats_enabled) {
+        return;
+    }
+    long long t = now_ns();
+    if (depth == 0) {
+        panic("stats_end() without stats_begin()");
+    }
+    Frame *frame = &stack[--depth];
+    Phase *phase = frame->phase;
+    long bytes = output_pos() - frame->start_bytes;
+    phase->calls += 1;
+    phase->self_ns += t - frame->inner_ns - frame->child_ns;
+    phase->emitted_bytes += bytes - frame->child_bytes;
+    phase->peak_rss_kb = peak_rss_kb();
+    if (depth > 0) {
+        stack[depth - 1].child_bytes += bytes;
+        // the parent isn't charged for our bookkeeping either
+        stack[depth - 1].child_ns += now_ns() - frame->start_ns;
+    }
+}
+
+extern void stats_set_output(FILE *out) {
+    output = out;
+}
+
+extern void stats_add(const char *name, long value) {
+    if (!stats_enabled) {
+        return;
+    }
+    for (int i = 0; i < counter_size; ++i) {
+        if (!strcmp(counters[i].name, name)) {
+            counters[i].value += value;
+            return;
+        }
+    }
+    if (counter_size == counter_capacity) {
+        counter_capacity = counter_capacity ? counter_capacity * 2 : 16;
+        counters = xrealloc(counters, counter_capacity * sizeof(Counter));
+    }
+    counters[counter_size].name = name;
+    counters[counter_size].value = value;
+    counter_size += 1;
+}
+
+extern void stats_count_nodes(RegexNode *regex) {
+    stats_add("regex_nodes", 1);
+    stats_add("branch_nodes", regex->size);
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        stats_add("piece_nodes", branch->size);
+        stats_add("atom_nodes", branch->size);
+        for (int j = 0; j < branch->size; ++j) {
+            AtomNode *atom = branch->pieces[j]->atom;
+            if (!atom->is_simple_atom) {
+                stats_count_nodes(atom->regex);
+            }
+        }
+    }
+}
+
+extern void stats_report(FILE *out) {
+    if (!stats_enabled) {
+        return;
+    }
+    // whatever was written outside a phase counts too
+    long emitted_bytes = output_pos();
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"wall_ms\": %.3f,\n", (now_ns() - start_ns) / 1e6);
+    fprintf(out, "  \"peak_rss_kb\": %ld,\n", peak_rss_kb());
+    fprintf(out, "  \"emitted_bytes\": %ld,\n", emitted_bytes);
+    fprintf(out, "  \"counts\": {");
+    for (int i = 0; i < counter_size; ++i) {
+        fprintf(out, "%s\n    \"%s\": %ld", i ? "," : "", counters[i].name, counters[i].value);
+    }
+    fprintf(out, "\n  },\n");
+    fprintf(out, "  \"phases\": [");
+    for (int i = 0; i < phase_size; ++i) {
+        Phase *phase = &phases[i];
+        fprintf(out, "%s\n    {\"phase\": \"%s\", \"calls\": %ld, \"wall_ms\": %.3f, "
+                "\"peak_rss_kb\": %ld, \"emitted_bytes\": %ld}",
+                i ? "," : "", phase->name, phase->calls, phase->self_ns / 1e6,
+                phase->peak_rss_kb, phase->emitted_bytes);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,28 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "regtree.h"
+
+// --stats: each phase of the generator runs between stats_begin() and
+// stats_end(). Phases nest, and the time of a phase doesn't include the
+// phases inside it. A phase that runs many times (tokenize runs once per
+// token) is summed up. Everything is a no-op until stats_init(), on the
+// thread that called it.
+extern _Thread_local bool stats_enabled;
+
+extern void stats_init(void);
+extern void stats_begin(const char *phase);
+extern void stats_end(void);
+// Bytes written to `out` are charged to the running phase. `out` has to be
+// seekable.
+extern void stats_set_output(FILE *out);
+extern void stats_add(const char *counter, long value);
+// adds the node count for each node type in the tree to the counters
+extern void stats_count_nodes(RegexNode *regex);
+// prints everything as one JSON object
+extern void stats_report(FILE *out);
+
+#endif
@@ -1,167 +1,914 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 #include <stdbool.h>
-#include <assert.h>
-#include <ctype.h>
 
 #include "xutils.h"
 #include "regtree.h"
+#include "nfa.h"
+#include "dfa.h"
+#include "byteclass.h"
+#include "search.h"
+#include "span.h"
+#include "profile.h"
+#include "stats.h"
+#include "to-dfa.h"
 
-void help(void) {
-    unimplemented("help");
+// In the generated tables state 0 is the dead state and DFA state `i` is
+// emitted as `i + 1`, so a zero in the transition table ends the scan.
+static const char *state_type(int count) {
+    if (count <= 0xff) {
+        return "uint8_t";
+    } else if (count <= 0xffff) {
+        return "uint16_t";
+    } else {
+        return "uint32_t";
+    }
 }
 
-int translate_atom(AtomNode *atom) {
-    static int cnt = 0;
-    int translate_regex(RegexNode *regex);
+// match_set() looks up accepted patterns in the accept tables instead of
+// dfa_accepting, see emit_accept_tables()
+static void emit_tables(Dfa *dfa, bool accepting, FILE *out) {
+    const char *type = state_type(dfa->size + 1);
+    int k = dfa->classes.size;
 
-    if (atom->is_simple_atom) {
-        printf("\
-int atom%03d(char *str) { // %s\n\
-    switch (((int)*str + 256) %% 256) {\n\
-", cnt, atom->annotation);
-        for (int i = 0; i < 256; ++i)
-            if (atom->u.allowed[i])
-                printf("        case %d: return 1;\n", i);
-        printf("\
-    }\n\
-    return -1;\n\
-}\n");
-    } else {
-        int id = translate_regex(atom->u.regex);
+    fprintf(out, "\nstatic const uint8_t dfa_byte_class[256] = {\n");
+    for (int c = 0; c < 256; ++c) {
+        fprintf(out, "%s%d,%s", c % 16 == 0 ? "    " : " ",
+                dfa->classes.class_of[c], c % 16 == 15 ? "\n" : "");
+    }
+    fprintf(out, "};\n");
 
-        printf("\
-int atom%03d(char *str) { // %s\n\
-    return regex%03d(str);\n\
-}\n\
-", cnt, atom->annotation, id);
+    if (accepting) {
+        fprintf(out, "\nstatic const uint8_t dfa_accepting[%d] = {\n    0,", dfa->size + 1);
+        for (int i = 0; i < dfa->size; ++i) {
+            fprintf(out, "%s%d,", i % 32 == 31 ? "\n    " : " ", dfa->accepting[i]);
+        }
+        fprintf(out, "\n};\n");
     }
 
-    return cnt++;
+    fprintf(out, "\nstatic const %s dfa_transitions[%d][%d] = {\n", type, dfa->size + 1, k);
+    fprintf(out, "    { 0 },\n");
+    for (int i = 0; i < dfa->size; ++i) {
+        fprintf(out, "    {");
+        for (int c = 0; c < k; ++c) {
+            fprintf(out, "%s%d,", c % 16 == 0 && c > 0 ? "\n     " : " ",
+                    dfa->transitions[i * k + c] + 1);
+        }
+        fprintf(out, " }, // state %d\n", i + 1);
+    }
+    fprintf(out, "};\n");
 }
 
-int translate_piece(PieceNode *piece) {
-    static int cnt = 0;
-    int id = translate_atom(piece->atom);
-    printf("\n\
-int piece%03d(char *str) { // %s\n\
-    char *str_old = str;\n\
-    for (int i = 0; i < %d; ++i) {\n\
-        int len = atom%03d(str);\n\
-        if (len == -1) {\n\
-            return -1;\n\
-        } else {\n\
-            str += len;\n\
-        }\n\
+// the accepted patterns of every emitted state, dead state included
+static void emit_accept_tables(Dfa *dfa, FILE *out) {
+    int total = dfa->accept_offset[dfa->size];
+
+    fprintf(out, "\nstatic const %s dfa_accept_offset[%d] = {\n    0,",
+            state_type(total), dfa->size + 2);
+    for (int i = 0; i <= dfa->size; ++i) {
+        fprintf(out, "%s%d,", i % 16 == 15 ? "\n    " : " ", dfa->accept_offset[i]);
+    }
+    fprintf(out, "\n};\n");
+
+    fprintf(out, "\nstatic const %s dfa_accepts[%d] = {",
+            state_type(dfa->pattern_count), total ? total : 1);
+    for (int i = 0; i < total; ++i) {
+        fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", dfa->accepts[i]);
+    }
+    fprintf(out, "%s\n};\n", total ? "" : " 0");
+}
+
+static void emit_table_match_set(Dfa *dfa, FILE *out) {
+    fprintf(out, "\n\
+int match_set(const unsigned char *buf, size_t len, ptrdiff_t *lengths) {\n\
+    unsigned state = %d;\n\
+    for (int k = 0; k < MATCH_SET_SIZE; ++k) {\n\
+        lengths[k] = -1;\n\
     }\n\
-", cnt, piece->annotation, piece->min, id);
-
-    if (piece->max == -1) {
-        printf("\n\
-    int allow_empty_match = 1;\n\
-    for (;;) {\n\
-        int len = atom%03d(str);\n\
-        if (len == -1) {\n\
+    for (unsigned k = dfa_accept_offset[state]; k < dfa_accept_offset[state + 1]; ++k) {\n\
+        lengths[dfa_accepts[k]] = 0;\n\
+    }\n\
+    for (size_t i = 0; i < len; ++i) {\n\
+        state = dfa_transitions[state][dfa_byte_class[buf[i]]];\n\
+        if (state == 0) {\n\
             break;\n\
-        } else if (len == 0) {\n\
-            if (allow_empty_match) {\n\
-                allow_empty_match = 0;\n\
-            } else {\n\
-                break;\n\
-            }\n\
-        } else {\n\
-            str += len;\n\
+        }\n\
+        for (unsigned k = dfa_accept_offset[state]; k < dfa_accept_offset[state + 1]; ++k) {\n\
+            lengths[dfa_accepts[k]] = i + 1;\n\
         }\n\
     }\n\
-", id);
-    } else {
-        printf("\n\
-    for (int i = %d; i < %d; ++i) {\n\
-        int len = atom%03d(str);\n\
-        if (len == -1) {\n\
+    return match_set_count(lengths);\n\
+}\n", dfa->start + 1);
+}
+
+static void emit_table_match(Dfa *dfa, bool profile, FILE *out) {
+    fprintf(out, "\n\
+%sptrdiff_t match_n%s(const unsigned char *buf, size_t len) {\n\
+    unsigned state = %d;\n\
+    ptrdiff_t last = dfa_accepting[state] ? 0 : -1;\n\
+    for (size_t i = 0; i < len; ++i) {\n%s\
+        state = dfa_transitions[state][dfa_byte_class[buf[i]]];\n\
+        if (state == 0) {\n\
             break;\n\
-        } else {\n\
-            str += len;\n\
+        }\n\
+        if (dfa_accepting[state]) {\n\
+            last = i + 1;\n\
         }\n\
     }\n\
-", piece->min, piece->max, id);
-    }
+    return last;\n\
+}\n", profile ? "static " : "", profile ? "_body" : "", dfa->start + 1,
+            profile ? "        match_state_bytes[state] += 1;\n" : "");
+}
 
-    printf("\
-    return str - str_old;\n\
+// the NUL terminated interface every backend provides
+static void emit_match_wrapper(FILE *out) {
+    fprintf(out, "\n\
+int match(char *str) {\n\
+    return (int)match_n((const unsigned char *)str, strlen(str));\n\
 }\n");
+}
 
-    return cnt++;
-}
-
-int translate_branch(BranchNode *branch) {
-    static int cnt = 0;
-    int *pieces = malloc(sizeof(int) * branch->size);
-    for (int i = 0; i < branch->size; ++i)
-        pieces[i] = translate_piece(branch->pieces[i]);
-    printf("\n\
-int branch%03d(char *str) { // %s\n\
-    char *str_old = str;\n\
-    int len = 0;\n\
-", cnt, branch->annotation);
-    for (int i = 0; i < branch->size; ++i)
-        printf("\n\
-    len = piece%03d(str);\n\
-    if (len == -1) {\n\
-        return -1;\n\
-    } else {\n\
-        str += len;\n\
+// Streaming: match_feed() runs the automaton over one chunk at a time and
+// keeps the state in a match_state_t, so a match can span any number of
+// chunks. The result is the same as match_n() over the concatenation.
+static void emit_stream_api(Dfa *dfa, FILE *out) {
+    fprintf(out, "\n\
+typedef struct {\n\
+    unsigned state;     // 0 once no longer match is possible\n\
+    size_t offset;      // bytes fed so far\n\
+    ptrdiff_t last;     // length of the longest match so far, -1 if none\n\
+    size_t count;       // bytes read of the counting run that st->state starts\n\
+} match_state_t;\n\
+\n\
+void match_init(match_state_t *st) {\n\
+    st->state = %d;\n\
+    st->offset = 0;\n\
+    st->last = %d;\n\
+    st->count = 0;\n\
+}\n\
+\n\
+ptrdiff_t match_finish(match_state_t *st) {\n\
+    return st->last;\n\
+}\n", dfa->start + 1, dfa->accepting[dfa->start] ? 0 : -1);
+}
+
+// returns 0 once the match can no longer grow, so the caller can stop feeding
+static void emit_table_feed(FILE *out) {
+    fprintf(out, "\n\
+int match_feed(match_state_t *st, const unsigned char *buf, size_t len) {\n\
+    unsigned state = st->state;\n\
+    if (state == 0) {\n\
+        return 0;\n\
     }\n\
-", pieces[i]);
+    for (size_t i = 0; i < len; ++i) {\n\
+        state = dfa_transitions[state][dfa_byte_class[buf[i]]];\n\
+        if (state == 0) {\n\
+            st->state = 0;\n\
+            return 0;\n\
+        }\n\
+        if (dfa_accepting[state]) {\n\
+            st->last = st->offset + i + 1;\n\
+        }\n\
+    }\n\
+    st->state = state;\n\
+    st->offset += len;\n\
+    return 1;\n\
+}\n");
+}
 
-    free(pieces);
+// match_batch() walks BATCH_LANES inputs through the tables in lockstep: the
+// lanes do not depend on each other, so their table loads overlap instead
+// of every step waiting for the previous one. Each lane lives in its own
+// locals so that the lanes stay in registers. The lanes run a stretch that
+// none of them can overrun without any checks (the dead state loops on
+// itself), then finished lanes take the next inputs. Four lanes is where
+// x86-64 stops having registers for all of them.
+#define BATCH_LANES 4
+#define BATCH_STRETCH 16
 
-    printf("\
-    return str - str_old;\n\
-}\n");
-    return cnt++;
-}
-
-int translate_regex(RegexNode *regex) {
-    static int cnt = 0;
-    int *branches = malloc(sizeof(int) * regex->size);
-    for (int i = 0; i < regex->size; ++i)
-        branches[i] = translate_branch(regex->branches[i]);
-    printf("\n\
-int regex%03d(char *str) { // %s\n\
-    int len = 0;\n\
-    int max = -1;\n\
-", cnt, regex->annotation);
-    for (int i = 0; i < regex->size; ++i)
-        printf("\n\
-    len = branch%03d(str);\n\
-    if (len > max) {\n\
-        max = len;\n\
+static void emit_lane_start(int l, const char *indent, FILE *out) {
+    fprintf(out, "\
+%sb%d = p%d = bufs[next];\n\
+%se%d = b%d + lens[next];\n\
+%sid%d = next++;\n\
+%ss%d = MATCH_BATCH_START;\n\
+%sh%d = dfa_accepting[MATCH_BATCH_START] ? 0 : -1;\n",
+            indent, l, l, indent, l, l, indent, l, indent, l, indent, l);
+}
+
+static void emit_table_batch(Dfa *dfa, FILE *out) {
+    fprintf(out, "\n\
+#define MATCH_BATCH_START %d\n\
+\n\
+// finishes a lane on its own once there are no inputs left to interleave\n\
+static ptrdiff_t match_resume(unsigned state, const unsigned char *p, const unsigned char *end,\n\
+        const unsigned char *buf, ptrdiff_t last) {\n\
+    for (; p != end && state != 0; ++p) {\n\
+        state = dfa_transitions[state][dfa_byte_class[*p]];\n\
+        if (dfa_accepting[state]) {\n\
+            last = p + 1 - buf;\n\
+        }\n\
     }\n\
-", branches[i]);
+    return last;\n\
+}\n\
+\n\
+void match_batch(const unsigned char **bufs, const size_t *lens, size_t n, ptrdiff_t *out) {\n\
+    size_t next = 0;\n\
+    if (n < %d) {\n\
+        for (; next < n; ++next) {\n\
+            out[next] = match_n(bufs[next], lens[next]);\n\
+        }\n\
+        return;\n\
+    }\n\
+\n", dfa->start + 1, BATCH_LANES);
+
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+    const unsigned char *b%d, *p%d, *e%d;\n\
+    size_t id%d;\n\
+    unsigned s%d;\n\
+    ptrdiff_t h%d;\n", l, l, l, l, l, l);
+        emit_lane_start(l, "    ", out);
+    }
+
+    fprintf(out, "\n    for (;;) {\n");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+        while (p%d == e%d || s%d == 0) {\n\
+            out[id%d] = h%d;\n\
+            id%d = SIZE_MAX;\n\
+            if (next == n) {\n\
+                goto drain;\n\
+            }\n", l, l, l, l, l, l);
+        emit_lane_start(l, "            ", out);
+        fprintf(out, "        }\n");
+    }
 
-    printf("\
-    return max;\n\
+    fprintf(out, "\n        size_t stretch = %d;\n", BATCH_STRETCH);
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+        if ((size_t)(e%d - p%d) < stretch) {\n\
+            stretch = e%d - p%d;\n\
+        }\n", l, l, l, l);
+    }
+    // a%d is 1 + the last accepting step of the stretch, 0 if none
+    fprintf(out, "        size_t");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "%s a%d = 0", l ? "," : "", l);
+    }
+    fprintf(out, ";\n        for (size_t i = 0; i < stretch; ++i) {\n");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+            s%d = dfa_transitions[s%d][dfa_byte_class[p%d[i]]];\n\
+            a%d = dfa_accepting[s%d] ? i + 1 : a%d;\n", l, l, l, l, l, l);
+    }
+    fprintf(out, "        }\n");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+        if (a%d != 0) {\n\
+            h%d = p%d - b%d + a%d;\n\
+        }\n\
+        p%d += stretch;\n", l, l, l, l, l, l);
+    }
+    fprintf(out, "    }\n\ndrain:\n");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+    if (id%d != SIZE_MAX) {\n\
+        out[id%d] = match_resume(s%d, p%d, e%d, b%d, h%d);\n\
+    }\n", l, l, l, l, l, l, l);
+    }
+    fprintf(out, "}\n");
+}
+
+// The goto automaton keeps its state in the program counter, so there is
+// nothing to interleave; the batch is a plain loop.
+static void emit_direct_batch(FILE *out) {
+    fprintf(out, "\n\
+void match_batch(const unsigned char **bufs, const size_t *lens, size_t n, ptrdiff_t *out) {\n\
+    for (size_t i = 0; i < n; ++i) {\n\
+        out[i] = match_n(bufs[i], lens[i]);\n\
+    }\n\
 }\n");
+}
 
-    free(branches);
-    return cnt++;
+// Direct-coded output: every state is a label inside match_n() and the byte
+// dispatch is a binary search over the ranges of bytes that share a target,
+// emitted as nested `if`s ending in `goto`.
+typedef struct {
+    int lo, hi;
+    int target;     // DFA state, -1 to stop scanning
+} Segment;
+
+static int collect_segments(Dfa *dfa, int state, Segment *seg) {
+    int size = 0;
+    for (int c = 0; c < 256; ++c) {
+        int target = dfa->transitions[state * dfa->classes.size + dfa->classes.class_of[c]];
+        if (size > 0 && seg[size - 1].target == target) {
+            seg[size - 1].hi = c;
+        } else {
+            seg[size].lo = c;
+            seg[size].hi = c;
+            seg[size].target = target;
+            size += 1;
+        }
+    }
+    return size;
 }
 
-void do_you_like_c(RegexNode *regex) {
-    int id = translate_regex(regex);
-    printf("\n\
-int match(char *str) {\n\
-    return regex%03d(str);\n\
-}\n", id);
+static void emit_goto(int target, int depth, FILE *out) {
+    if (target == -1) {
+        fprintf(out, "%*sgoto done;\n", depth * 4, "");
+    } else {
+        fprintf(out, "%*sgoto s%d;\n", depth * 4, "", target + 1);
+    }
+}
+
+static void emit_dispatch(Segment *seg, int lo, int hi, int depth, FILE *out) {
+    if (lo == hi) {
+        emit_goto(seg[lo].target, depth, out);
+    } else if (hi - lo == 2 && seg[lo].target == seg[hi].target) {
+        // a single range surrounded by one target, e.g. [a-z] in a string
+        if (seg[lo + 1].lo == seg[lo + 1].hi) {
+            fprintf(out, "%*sif (c == %d) {\n", depth * 4, "", seg[lo + 1].lo);
+        } else {
+            fprintf(out, "%*sif (c >= %d && c <= %d) {\n", depth * 4, "", seg[lo + 1].lo, seg[lo + 1].hi);
+        }
+        emit_goto(seg[lo + 1].target, depth + 1, out);
+        fprintf(out, "%*s}\n", depth * 4, "");
+        emit_goto(seg[lo].target, depth, out);
+    } else {
+        int mid = (lo + hi + 1) / 2;
+        fprintf(out, "%*sif (c < %d) {\n", depth * 4, "", seg[mid].lo);
+        emit_dispatch(seg, lo, mid - 1, depth + 1, out);
+        fprintf(out, "%*s}\n", depth * 4, "");
+        emit_dispatch(seg, mid, hi, depth, out);
+    }
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2)
-        help();
-    RegexNode *result = regtree_from_str(argv[1]);
-    do_you_like_c(result);
-    regtree_drop(result);
-    return 0;
+// the bytes on which `state` loops back to itself
+static bool self_loop(Dfa *dfa, int state, Charset *allowed) {
+    bool result = false;
+    for (int c = 0; c < 256; ++c) {
+        bool loops = dfa->transitions[state * dfa->classes.size + dfa->classes.class_of[c]] == state;
+        charset_put(allowed, c, loops);
+        result = result || loops;
+    }
+    return result;
+}
+
+// A counting run is a chain of states s_1 .. s_len, where each s_j goes to
+// s_j+1 on the bytes in `allowed` and to `other` on all the rest, all accept
+// the same patterns, and only s_1 can be entered from outside. [a-z]{1000}
+// unrolls into such a run of 1000 states. The direct emitter reads a whole
+// run with one capped span kernel and a counter instead of a label per
+// state, so large bounds cost neither code size nor a branch per byte.
+typedef struct {
+    int head;
+    int len;
+    int exit;       // where the byte after s_len goes
+    int other;      // -1 for the dead state, -2 if every byte is allowed
+    Charset allowed;
+} Run;
+
+// shorter runs are emitted state by state
+#define RUN_MIN 4
+
+// What the direct-coded functions of one automaton share: span kernels for
+// states that loop on themselves, and for counting runs.
+typedef struct {
+    bool *looping;
+    Run *runs;
+    int run_count;
+    int *run_of;    // the run each state belongs to, -1 if none
+} DirectKernels;
+
+static bool same_accepts(Dfa *dfa, int a, int b) {
+    int size = dfa->accept_offset[a + 1] - dfa->accept_offset[a];
+    if (size != dfa->accept_offset[b + 1] - dfa->accept_offset[b]) {
+        return false;
+    }
+    for (int i = 0; i < size; ++i) {
+        if (dfa->accepts[dfa->accept_offset[a] + i] != dfa->accepts[dfa->accept_offset[b] + i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether `state` goes to one live target on exactly the classes `on` and
+// to `other` on every other class (-2: there are no others); sets *target.
+// -1 is the dead state, so whether *target is set yet is kept apart: a
+// state that goes dead on some of `on` and elsewhere on the rest is no
+// part of a run.
+static bool run_shape(Dfa *dfa, int state, const bool *on, int other, int *target) {
+    int k = dfa->classes.size;
+    bool set = false;
+    *target = -1;
+    for (int c = 0; c < k; ++c) {
+        int t = dfa->transitions[state * k + c];
+        if (!on[c]) {
+            if (other == -2 || t != other) {
+                return false;
+            }
+        } else if (!set) {
+            *target = t;
+            set = true;
+        } else if (t != *target) {
+            return false;
+        }
+    }
+    return set && *target != -1 && *target != other;
+}
+
+static void find_runs(Dfa *dfa, DirectKernels *kernels) {
+    int k = dfa->classes.size;
+    int *predecessors = xmalloc(dfa->size * sizeof(int));
+    int *last_pred = xmalloc(dfa->size * sizeof(int));
+    int *next = xmalloc(dfa->size * sizeof(int));
+    int *others = xmalloc(dfa->size * sizeof(int));
+    bool *interior = xmalloc(dfa->size * sizeof(bool));
+    bool *on = xmalloc(k * sizeof(bool));
+    for (int i = 0; i < dfa->size; ++i) {
+        predecessors[i] = 0;
+        last_pred[i] = -1;
+        interior[i] = false;
+    }
+    for (int i = 0; i < dfa->size; ++i) {
+        for (int c = 0; c < k; ++c) {
+            int t = dfa->transitions[i * k + c];
+            if (t != -1 && last_pred[t] != i) {
+                last_pred[t] = i;
+                predecessors[t] += 1;
+            }
+        }
+    }
+
+    // next[i] is the state after i in a run, if there is one
+    for (int i = 0; i < dfa->size; ++i) {
+        next[i] = -1;
+        for (int c = 0; c < k && next[i] == -1; ++c) {
+            int t = dfa->transitions[i * k + c];
+            if (t == -1 || t == i || t == dfa->start || predecessors[t] != 1 || !same_accepts(dfa, i, t)) {
+                continue;
+            }
+            int other = -2, exit_i, exit_t;
+            for (int d = 0; d < k; ++d) {
+                on[d] = dfa->transitions[i * k + d] == t;
+                if (!on[d]) {
+                    other = dfa->transitions[i * k + d];
+                }
+            }
+            if (other != i && run_shape(dfa, i, on, other, &exit_i)
+                    && run_shape(dfa, t, on, other, &exit_t) && exit_t != t) {
+                next[i] = t;
+                others[i] = other;
+                interior[t] = true;
+            }
+        }
+    }
+
+    kernels->runs = NULL;
+    kernels->run_count = 0;
+    kernels->run_of = xmalloc(dfa->size * sizeof(int));
+    for (int i = 0; i < dfa->size; ++i) {
+        kernels->run_of[i] = -1;
+    }
+    int capacity = 0;
+    for (int i = 0; i < dfa->size; ++i) {
+        if (interior[i] || next[i] == -1) {
+            continue;
+        }
+        int len = 1, last = i;
+        while (next[last] != -1 && interior[next[last]] && len < dfa->size) {
+            last = next[last];
+            len += 1;
+        }
+        if (len < RUN_MIN) {
+            continue;
+        }
+        if (kernels->run_count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            kernels->runs = xrealloc(kernels->runs, capacity * sizeof(Run));
+        }
+        Run *run = &kernels->runs[kernels->run_count];
+        run->head = i;
+        run->len = len;
+        run->other = others[i];
+        run->exit = -1;
+        for (int c = 0; c < 256; ++c) {
+            int t = dfa->transitions[last * k + dfa->classes.class_of[c]];
+            bool allowed = dfa->transitions[i * k + dfa->classes.class_of[c]] == next[i];
+            charset_put(&run->allowed, c, allowed);
+            if (allowed) {
+                run->exit = t;
+            }
+        }
+        for (int s = i, j = 0; j < len; s = next[s], ++j) {
+            kernels->run_of[s] = kernels->run_count;
+        }
+        kernels->run_count += 1;
+    }
+
+    free(predecessors);
+    free(last_pred);
+    free(next);
+    free(others);
+    free(interior);
+    free(on);
+}
+
+// Emits the span kernels of the states that loop on themselves and of the
+// counting runs; every direct-coded function shares them.
+static void emit_direct_kernels(Dfa *dfa, DirectKernels *kernels, FILE *out) {
+    Charset allowed;
+    kernels->looping = xmalloc(dfa->size * sizeof(bool));
+    find_runs(dfa, kernels);
+    bool any_span = kernels->run_count > 0;
+    for (int i = 0; i < dfa->size; ++i) {
+        kernels->looping[i] = self_loop(dfa, i, &allowed);
+        any_span = any_span || kernels->looping[i];
+    }
+    if (any_span) {
+        emit_span_prologue(out);
+    }
+    for (int i = 0; i < dfa->size; ++i) {
+        if (kernels->looping[i]) {
+            char annotation[64];
+            self_loop(dfa, i, &allowed);
+            int len = snprintf(annotation, sizeof(annotation), "self loop of s%d", i + 1);
+            emit_span(i + 1, &allowed, annotation, len, out);
+        }
+    }
+    // a run never loops on its head, so the ids don't clash
+    for (int r = 0; r < kernels->run_count; ++r) {
+        Run *run = &kernels->runs[r];
+        char annotation[64];
+        int len = snprintf(annotation, sizeof(annotation), "counting run of s%d, %d states", run->head + 1, run->len);
+        emit_span(run->head + 1, &run->allowed, annotation, len, out);
+    }
+}
+
+static void direct_kernels_drop(DirectKernels *kernels) {
+    free(kernels->looping);
+    free(kernels->runs);
+    free(kernels->run_of);
+}
+
+// The functions that share the direct-coded automaton differ only in how
+// they start, what an accepting state records and what running out of
+// input does.
+typedef enum {
+    DIRECT_MATCH_N,     // last = p, end of input finishes
+    DIRECT_MATCH_SET,   // lengths[pattern] = p - buf for every accepted pattern
+    DIRECT_FEED,        // resumes at st->state, end of input suspends
+} DirectFlavor;
+
+// records that the automaton accepts after the input before `pos`
+static void emit_accept(Dfa *dfa, int state, DirectFlavor flavor, const char *pos, FILE *out) {
+    if (flavor == DIRECT_MATCH_SET) {
+        for (int a = dfa->accept_offset[state]; a < dfa->accept_offset[state + 1]; ++a) {
+            fprintf(out, "    lengths[%d] = %s - buf;\n", dfa->accepts[a], pos);
+        }
+    } else if (flavor == DIRECT_FEED && dfa->accepting[state]) {
+        fprintf(out, "    st->last = st->offset + (%s - buf);\n", pos);
+    } else if (dfa->accepting[state]) {
+        fprintf(out, "    last = %s;\n", pos);
+    }
+}
+
+// the end of the input in `state`; a counting run also saves its counter
+static void emit_wait(int state, DirectFlavor flavor, bool counting, FILE *out) {
+    if (flavor == DIRECT_FEED) {
+        fprintf(out, "\
+    if (p == end) {\n\
+        st->state = %d;\n%s\
+        goto suspend;\n\
+    }\n", state + 1, counting ? "        st->count = count;\n" : "");
+    } else {
+        fprintf(out, "\
+    if (p == end) {\n\
+        goto done;\n\
+    }\n");
+    }
+}
+
+// s_1 of a run reads up to len bytes of the run at once; count is how many
+// of them it has read, so st->count lets a feed resume in the middle
+static void emit_run(Dfa *dfa, Run *run, DirectFlavor flavor, bool profile, FILE *out) {
+    int head = run->head;
+    fprintf(out, "    count = 0;\n");
+    if (flavor == DIRECT_FEED) {
+        fprintf(out, "s%d_resume:\n", head + 1);
+    }
+    fprintf(out, "\
+    {\n\
+        size_t n = end - p;\n\
+        if (n > %d - count) {\n\
+            n = %d - count;\n\
+        }\n\
+        n = span%03d(p, n);\n", run->len, run->len, head + 1);
+    if (profile) {
+        fprintf(out, "        match_state_bytes[%d] += n;\n", head + 1);
+    }
+    fprintf(out, "\
+        p += n;\n\
+        count += n;\n\
+    }\n");
+    // every state of the run accepts alike, and after len bytes the last
+    // one was s_len, a byte before p
+    char pos[32];
+    snprintf(pos, sizeof(pos), "(count < %d ? p : p - 1)", run->len);
+    emit_accept(dfa, head, flavor, pos, out);
+    fprintf(out, "    if (count == %d) {\n", run->len);
+    emit_goto(run->exit, 2, out);
+    fprintf(out, "    }\n");
+    emit_wait(head, flavor, true, out);
+    // neither the end of the run nor of the input, so *p isn't allowed
+    if (profile) {
+        fprintf(out, "    match_state_bytes[%d] += 1;\n", head + 1);
+    }
+    fprintf(out, "    p++;\n");
+    emit_goto(run->other == -2 ? -1 : run->other, 1, out);
+}
+
+static void emit_direct_match(Dfa *dfa, DirectKernels *kernels, DirectFlavor flavor, bool profile, FILE *out) {
+    // only match_n() counts the bytes read in each state
+    profile = profile && flavor == DIRECT_MATCH_N;
+    int k = dfa->classes.size;
+    bool *targeted = xmalloc(dfa->size * sizeof(bool));
+    for (int i = 0; i < dfa->size; ++i) {
+        // a suspended feed can resume in any state
+        targeted[i] = flavor == DIRECT_FEED;
+    }
+    for (int i = 0; i < dfa->size * k; ++i) {
+        if (dfa->transitions[i] != -1) {
+            targeted[dfa->transitions[i]] = true;
+        }
+    }
+
+    // which of `c`, `end` and the exit label are used at all, so that the
+    // output compiles cleanly with -Wall
+    Segment seg[256];
+    bool reads = false, waits = kernels->run_count > 0, stops = false;
+    for (int r = 0; r < kernels->run_count; ++r) {
+        stops = stops || kernels->runs[r].other < 0;
+    }
+    for (int i = 0; i < dfa->size; ++i) {
+        if (kernels->run_of[i] != -1) {
+            continue;
+        }
+        int size = collect_segments(dfa, i, seg);
+        reads = reads || size > 1;
+        waits = waits || size > 1 || seg[0].target != -1;
+        for (int j = 0; j < size; ++j) {
+            stops = stops || seg[j].target == -1;
+        }
+    }
+    const char *end_decl = waits ? ", *end = buf + len" : "";
+
+    if (flavor == DIRECT_MATCH_SET) {
+        fprintf(out, "\n\
+int match_set(const unsigned char *buf, size_t len, ptrdiff_t *lengths) {\n\
+    const unsigned char *p = buf%s;\n\
+    for (int k = 0; k < MATCH_SET_SIZE; ++k) {\n\
+        lengths[k] = -1;\n\
+    }\n", end_decl);
+    } else if (flavor == DIRECT_FEED) {
+        fprintf(out, "\n\
+int match_feed(match_state_t *st, const unsigned char *buf, size_t len) {\n\
+    const unsigned char *p = buf%s;\n", end_decl);
+    } else {
+        fprintf(out, "\n\
+%sptrdiff_t match_n%s(const unsigned char *buf, size_t len) {\n\
+    const unsigned char *p = buf%s;\n\
+    const unsigned char *last = NULL;\n",
+                profile ? "static " : "", profile ? "_body" : "", end_decl);
+    }
+    if (reads) {
+        fprintf(out, "    unsigned char c;\n");
+    }
+    if (kernels->run_count > 0) {
+        fprintf(out, "    size_t count;\n");
+    }
+    if (!waits) {
+        fprintf(out, "    (void)len;\n");
+    }
+    if (flavor == DIRECT_FEED) {
+        fprintf(out, "\n    switch (st->state) {\n");
+        for (int i = 0; i < dfa->size; ++i) {
+            int r = kernels->run_of[i];
+            if (r == -1) {
+                fprintf(out, "    case %d: goto s%d;\n", i + 1, i + 1);
+            } else if (kernels->runs[r].head == i) {
+                fprintf(out, "    case %d: count = st->count; goto s%d_resume;\n", i + 1, i + 1);
+            }
+        }
+        fprintf(out, "    default: return 0;\n    }\n");
+    }
+
+    for (int n = 0; n < dfa->size; ++n) {
+        // the start state goes first so that control falls into it
+        int i = n == 0 ? dfa->start : (n <= dfa->start ? n - 1 : n);
+        int r = kernels->run_of[i];
+        if (r != -1 && kernels->runs[r].head != i) {
+            continue;
+        }
+        if (targeted[i]) {
+            fprintf(out, "\ns%d:\n", i + 1);
+        } else {
+            fprintf(out, "\n    // s%d\n", i + 1);
+        }
+        if (r != -1) {
+            emit_run(dfa, &kernels->runs[r], flavor, profile, out);
+            continue;
+        }
+        if (kernels->looping[i] && profile) {
+            fprintf(out, "\
+    {\n\
+        size_t n = span%03d(p, end - p);\n\
+        match_state_bytes[%d] += n;\n\
+        p += n;\n\
+    }\n", i + 1, i + 1);
+        } else if (kernels->looping[i]) {
+            fprintf(out, "    p += span%03d(p, end - p);\n", i + 1);
+        }
+        emit_accept(dfa, i, flavor, "p", out);
+
+        int size = collect_segments(dfa, i, seg);
+        if (size == 1 && seg[0].target == -1) {
+            emit_goto(-1, 1, out);
+            continue;
+        }
+
+        emit_wait(i, flavor, false, out);
+        if (profile) {
+            fprintf(out, "    match_state_bytes[%d] += 1;\n", i + 1);
+        }
+        if (size == 1) {
+            fprintf(out, "    p++;\n");
+            emit_goto(seg[0].target, 1, out);
+        } else {
+            fprintf(out, "    c = *p++;\n");
+            emit_dispatch(seg, 0, size - 1, 1, out);
+        }
+    }
+
+    // every state ends in a goto, so the code below is only reached
+    // through its labels
+    bool done_used = stops || (waits && flavor != DIRECT_FEED);
+    fprintf(out, "\n%s", done_used ? "done:\n" : "");
+    if (flavor == DIRECT_FEED) {
+        fprintf(out, "\
+    st->state = 0;\n\
+    return 0;\n");
+        if (waits) {
+            fprintf(out, "\n\
+suspend:\n\
+    st->offset += len;\n\
+    return 1;\n");
+        }
+    } else {
+        fprintf(out, "    return %s;\n",
+                flavor == DIRECT_MATCH_SET ? "match_set_count(lengths)" : "last == NULL ? -1 : last - buf");
+    }
+    fprintf(out, "}\n");
+
+    free(targeted);
+}
+
+// -p: the counters that match_n_body() updates
+static void emit_profile_prologue(Dfa *dfa, FILE *out) {
+    fprintf(out, "#include <stdio.h>\n");
+    emit_profile_counters("match_n", out);
+    fprintf(out, "static unsigned long long match_state_bytes[%d];\n", dfa->size + 1);
+}
+
+// -p: match_n() around match_n_body(), and match_dump_stats()
+static void emit_profile_epilogue(Dfa *dfa, RegexNode *regex, FILE *out) {
+    emit_profile_wrapper("match_n", "const unsigned char *buf, size_t len", "buf, len", out);
+    emit_profile_dump_begin(out);
+    emit_profile_dump_row("match_n", regex->anno_start, regex->anno_len, out);
+    fprintf(out, "\
+    for (int i = 1; i < %d; ++i) {\n\
+        if (match_state_bytes[i] != 0) {\n\
+            fprintf(out, \"    s%%d read %%llu bytes\\n\", i, match_state_bytes[i]);\n\
+        }\n\
+    }\n", dfa->size + 1);
+    emit_profile_dump_end(out);
+}
+
+static Dfa *build_dfa(RegexNode **regexes, int count) {
+    ByteClasses classes;
+    stats_begin("byteclass");
+    byteclasses_from_regtrees(regexes, count, &classes);
+    stats_end();
+    stats_add("byte_classes", classes.size);
+
+    stats_begin("nfa");
+    Nfa *nfa = nfa_from_regtrees(regexes, count);
+    stats_end();
+    stats_add("nfa_states", nfa->size);
+
+    stats_begin("subset");
+    Dfa *dfa = dfa_from_nfa(nfa, &classes);
+    nfa_drop(nfa);
+    stats_end();
+    stats_add("dfa_states", dfa->size);
+
+    stats_begin("minimize");
+    Dfa *minimized = dfa_minimize(dfa);
+    stats_end();
+    stats_add("minimized_states", minimized->size);
+    dfa_drop(dfa);
+    return minimized;
+}
+
+extern void to_dfa(RegexNode *regex, DfaOptions *options, FILE *out) {
+    Dfa *dfa = build_dfa(&regex, 1);
+
+    stats_begin("emit");
+    if (options->emit == EMIT_DIRECT) {
+        fprintf(out, "\
+// %.*s\n\
+// %d DFA states, direct coded\n\
+#include <stddef.h>\n\
+#include <string.h>\n", regex->anno_len, regex->anno_start, dfa->size);
+        if (options->profile) {
+            emit_profile_prologue(dfa, out);
+        }
+        DirectKernels kernels;
+        emit_direct_kernels(dfa, &kernels, out);
+        emit_direct_match(dfa, &kernels, DIRECT_MATCH_N, options->profile, out);
+        if (options->profile) {
+            emit_profile_epilogue(dfa, regex, out);
+        }
+        emit_match_wrapper(out);
+        emit_stream_api(dfa, out);
+        emit_direct_match(dfa, &kernels, DIRECT_FEED, false, out);
+        emit_direct_batch(out);
+        direct_kernels_drop(&kernels);
+    } else {
+        fprintf(out, "\
+// %.*s\n\
+// %d DFA states, %d byte classes, table driven\n\
+#include <stddef.h>\n\
+#include <stdint.h>\n\
+#include <string.h>\n", regex->anno_len, regex->anno_start, dfa->size, dfa->classes.size);
+        if (options->profile) {
+            emit_profile_prologue(dfa, out);
+        }
+        emit_tables(dfa, true, out);
+        emit_table_match(dfa, options->profile, out);
+        if (options->profile) {
+            emit_profile_epilogue(dfa, regex, out);
+        }
+        emit_match_wrapper(out);
+        emit_stream_api(dfa, out);
+        emit_table_feed(out);
+        emit_table_batch(dfa, out);
+    }
+    stats_end();
+    stats_begin("search");
+    emit_search(regex, out);
+    stats_end();
+
+    dfa_drop(dfa);
+}
+
+extern void to_dfa_set(RegexNode **regexes, int count, DfaOptions *options, FILE *out) {
+    Dfa *dfa = build_dfa(regexes, count);
+
+    stats_begin("emit");
+    for (int i = 0; i < count; ++i) {
+        fprintf(out, "// pattern %d: %.*s\n", i, regexes[i]->anno_len, regexes[i]->anno_start);
+    }
+    fprintf(out, "\
+// %d DFA states, %d byte classes, %s\n\
+#include <stddef.h>\n\
+#include <stdint.h>\n\
+\n\
+#define MATCH_SET_SIZE %d\n\
+\n\
+static int match_set_count(const ptrdiff_t *lengths) {\n\
+    int count = 0;\n\
+    for (int k = 0; k < MATCH_SET_SIZE; ++k) {\n\
+        count += lengths[k] >= 0;\n\
+    }\n\
+    return count;\n\
+}\n", dfa->size, dfa->classes.size,
+            options->emit == EMIT_DIRECT ? "direct coded" : "table driven", count);
+
+    if (options->emit == EMIT_DIRECT) {
+        DirectKernels kernels;
+        emit_direct_kernels(dfa, &kernels, out);
+        emit_direct_match(dfa, &kernels, DIRECT_MATCH_SET, false, out);
+        direct_kernels_drop(&kernels);
+    } else {
+        emit_tables(dfa, false, out);
+        emit_accept_tables(dfa, out);
+        emit_table_match_set(dfa, out);
+    }
+    stats_end();
+
+    dfa_drop(dfa);
 }
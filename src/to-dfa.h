@@ -0,0 +1,22 @@
+#ifndef TO_DFA_H_
+#define TO_DFA_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "regtree.h"
+
+typedef enum {
+    EMIT_TABLE, EMIT_DIRECT
+} DfaEmitMode;
+
+typedef struct {
+    DfaEmitMode emit;
+    bool profile;   // count calls, matched bytes and the bytes read in each state
+} DfaOptions;
+
+extern void to_dfa(RegexNode *regex, DfaOptions *options, FILE *out);
+// one automaton for all patterns, reported through match_set()
+extern void to_dfa_set(RegexNode **regexes, int count, DfaOptions *options, FILE *out);
+
+#endif
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "xutils.h"
+#include "regtree.h"
+#include "search.h"
+#include "span.h"
+#include "profile.h"
+#include "stats.h"
+#include "to-glushkov.h"
+
+// Glushkov construction. Positions are numbered in the order they appear
+// in the pattern, so that most follow edges go from position p to p + 1
+// and become a single shift in the generated code.
+typedef struct {
+    int size;
+    Charset allowed[GLUSHKOV_MAX_POSITIONS];
+    uint64_t follow[GLUSHKOV_MAX_POSITIONS];
+} Positions;
+
+typedef struct {
+    uint64_t first, last;
+    bool nullable;
+} Fragment;
+
+static const Fragment empty = { 0, 0, true };
+
+static int saturate(long count) {
+    return count > GLUSHKOV_MAX_POSITIONS ? GLUSHKOV_MAX_POSITIONS + 1 : (int)count;
+}
+
+// how many copies of the atom the repetition needs: x{2,} is x x+
+static int copies(PieceNode *piece) {
+    if (piece->max == -1) {
+        return piece->min > 0 ? piece->min : 1;
+    }
+    return piece->max;
+}
+
+extern int glushkov_positions(RegexNode *regex) {
+    long count = 0;
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        for (int j = 0; j < branch->size; ++j) {
+            PieceNode *piece = branch->pieces[j];
+            long atom = piece->atom->is_simple_atom ? 1 : glushkov_positions(piece->atom->regex);
+            count = saturate(count + copies(piece) * atom);
+        }
+    }
+    return (int)count;
+}
+
+static void add_follow(Positions *pos, uint64_t from, uint64_t to) {
+    for (int p = 0; p < pos->size; ++p) {
+        if (from >> p & 1) {
+            pos->follow[p] |= to;
+        }
+    }
+}
+
+static Fragment concat(Positions *pos, Fragment a, Fragment b) {
+    add_follow(pos, a.last, b.first);
+    Fragment result;
+    result.first = a.first | (a.nullable ? b.first : 0);
+    result.last = b.last | (b.nullable ? a.last : 0);
+    result.nullable = a.nullable && b.nullable;
+    return result;
+}
+
+static Fragment build_regex(Positions *pos, RegexNode *regex);
+
+static Fragment build_atom(Positions *pos, AtomNode *atom) {
+    if (!atom->is_simple_atom) {
+        return build_regex(pos, atom->regex);
+    }
+    int p = pos->size++;
+    pos->allowed[p] = atom->allowed;
+    pos->follow[p] = 0;
+    Fragment result = { (uint64_t)1 << p, (uint64_t)1 << p, false };
+    return result;
+}
+
+// Optional copies are simply concatenated, x{1,3} as x x? x?; that is a
+// different automaton than x (x x?)? but the same language.
+static Fragment build_piece(Positions *pos, PieceNode *piece) {
+    Fragment result = empty;
+    for (int i = 0; i < copies(piece); ++i) {
+        Fragment atom = build_atom(pos, piece->atom);
+        if (piece->max == -1 && i == copies(piece) - 1) {
+            add_follow(pos, atom.last, atom.first);
+        }
+        if (i >= piece->min) {
+            atom.nullable = true;
+        }
+        result = concat(pos, result, atom);
+    }
+    return result;
+}
+
+static Fragment build_regex(Positions *pos, RegexNode *regex) {
+    Fragment result = { 0, 0, false };
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        Fragment seq = empty;
+        for (int j = 0; j < branch->size; ++j) {
+            seq = concat(pos, seq, build_piece(pos, branch->pieces[j]));
+        }
+        result.first |= seq.first;
+        result.last |= seq.last;
+        result.nullable = result.nullable || seq.nullable;
+    }
+    return result;
+}
+
+static void emit_masks(Positions *pos, FILE *out) {
+    fprintf(out, "\n// the positions that accept each byte\n");
+    fprintf(out, "static const uint64_t glushkov_mask[256] = {\n");
+    for (int c = 0; c < 256; ++c) {
+        uint64_t mask = 0;
+        for (int p = 0; p < pos->size; ++p) {
+            if (charset_has(&pos->allowed[p], c)) {
+                mask |= (uint64_t)1 << p;
+            }
+        }
+        fprintf(out, "%s0x%016llx,%s", c % 4 == 0 ? "    " : " ",
+                (unsigned long long)mask, c % 4 == 3 ? "\n" : "");
+    }
+    fprintf(out, "};\n");
+}
+
+// glushkov_follow(d) is every position that can come right after one in d.
+// Edges p -> p + 1 are the shift, edges p -> p the and; the rest are added
+// for each distinct set of targets, from all positions that share it.
+static void emit_follow(Positions *pos, FILE *out) {
+    uint64_t shift = 0, self = 0;
+    uint64_t rest[GLUSHKOV_MAX_POSITIONS];
+    for (int p = 0; p < pos->size; ++p) {
+        rest[p] = pos->follow[p];
+        if (p + 1 < pos->size && (rest[p] >> (p + 1) & 1)) {
+            shift |= (uint64_t)1 << (p + 1);
+            rest[p] &= ~((uint64_t)1 << (p + 1));
+        }
+        if (rest[p] >> p & 1) {
+            self |= (uint64_t)1 << p;
+            rest[p] &= ~((uint64_t)1 << p);
+        }
+    }
+
+    fprintf(out, "\n\
+static inline uint64_t glushkov_follow(uint64_t d) {\n\
+    uint64_t f = ((d << 1) & 0x%016llxull) | (d & 0x%016llxull);\n",
+            (unsigned long long)shift, (unsigned long long)self);
+    bool done[GLUSHKOV_MAX_POSITIONS] = { false };
+    for (int p = 0; p < pos->size; ++p) {
+        if (done[p] || rest[p] == 0) {
+            continue;
+        }
+        uint64_t sources = 0;
+        for (int q = p; q < pos->size; ++q) {
+            if (!done[q] && rest[q] == rest[p]) {
+                sources |= (uint64_t)1 << q;
+                done[q] = true;
+            }
+        }
+        fprintf(out, "\
+    f |= 0x%016llxull & -(uint64_t)((d & 0x%016llxull) != 0);\n",
+                (unsigned long long)rest[p], (unsigned long long)sources);
+    }
+    fprintf(out, "\
+    return f;\n\
+}\n");
+}
+
+// While the only active position loops on itself and the bytes start
+// nothing else, nothing changes; match_n() skips such bytes with a span
+// kernel. Each one costs a compare per byte, so there are only a few.
+#define GLUSHKOV_MAX_SPANS 4
+
+static bool span_charset(Positions *pos, int p, Charset *allowed) {
+    bool any = false;
+    memset(allowed, 0, sizeof(Charset));
+    if (!(pos->follow[p] >> p & 1)) {
+        return false;
+    }
+    for (int c = 0; c < 256; ++c) {
+        bool only = charset_has(&pos->allowed[p], c);
+        for (int q = 0; q < pos->size && only; ++q) {
+            if (q != p && (pos->follow[p] >> q & 1) && charset_has(&pos->allowed[q], c)) {
+                only = false;
+            }
+        }
+        charset_put(allowed, c, only);
+        any = any || only;
+    }
+    return any;
+}
+
+static int emit_spans(Positions *pos, int *spans, FILE *out) {
+    int count = 0;
+    Charset allowed;
+    for (int p = 0; p < pos->size && count < GLUSHKOV_MAX_SPANS; ++p) {
+        if (span_charset(pos, p, &allowed)) {
+            if (count == 0) {
+                emit_span_prologue(out);
+            }
+            char annotation[64];
+            int len = snprintf(annotation, sizeof(annotation), "self loop of position %d", p);
+            emit_span(p, &allowed, annotation, len, out);
+            spans[count++] = p;
+        }
+    }
+    return count;
+}
+
+static void emit_match(Fragment *whole, int *spans, int span_count, bool profile, FILE *out) {
+    fprintf(out, "\n\
+#define GLUSHKOV_FIRST 0x%016llxull\n\
+#define GLUSHKOV_LAST 0x%016llxull\n\
+#define GLUSHKOV_NULLABLE %d\n\
+\n\
+%sptrdiff_t match_n%s(const unsigned char *buf, size_t len) {\n\
+    ptrdiff_t last = GLUSHKOV_NULLABLE ? 0 : -1;\n\
+    if (len == 0) {\n\
+        return last;\n\
+    }\n\
+    uint64_t d = GLUSHKOV_FIRST & glushkov_mask[buf[0]];\n\
+    for (size_t i = 1; d != 0; ++i) {\n\
+        if (d & GLUSHKOV_LAST) {\n\
+            last = i;\n\
+        }\n\
+        if (i == len) {\n\
+            break;\n\
+        }\n", (unsigned long long)whole->first, (unsigned long long)whole->last, whole->nullable,
+            profile ? "static " : "", profile ? "_body" : "");
+    for (int k = 0; k < span_count; ++k) {
+        int p = spans[k];
+        fprintf(out, "\
+        %sif (d == 0x%016llxull) {\n\
+            i += span%03d(buf + i, len - i);\n", k ? "} else " : "", (unsigned long long)1 << p, p);
+        if (whole->last >> p & 1) {
+            fprintf(out, "\
+            last = i;\n");
+        }
+        fprintf(out, "\
+            if (i == len) {\n\
+                break;\n\
+            }\n");
+    }
+    fprintf(out, "%s\
+        d = glushkov_follow(d) & glushkov_mask[buf[i]];\n\
+    }\n\
+    return last;\n\
+}\n", span_count ? "        }\n" : "");
+}
+
+// the active positions are all the state there is
+static void emit_stream_api(FILE *out) {
+    fprintf(out, "\n\
+typedef struct {\n\
+    uint64_t d;\n\
+    int started;\n\
+    size_t pos;\n\
+    ptrdiff_t last;\n\
+} match_state_t;\n\
+\n\
+void match_init(match_state_t *st) {\n\
+    st->d = 0;\n\
+    st->started = 0;\n\
+    st->pos = 0;\n\
+    st->last = GLUSHKOV_NULLABLE ? 0 : -1;\n\
+}\n\
+\n\
+int match_feed(match_state_t *st, const unsigned char *buf, size_t len) {\n\
+    uint64_t d = st->d;\n\
+    size_t i = 0;\n\
+    if (len == 0) {\n\
+        return !st->started || d != 0;\n\
+    }\n\
+    if (!st->started) {\n\
+        st->started = 1;\n\
+        d = GLUSHKOV_FIRST & glushkov_mask[buf[0]];\n\
+        if (d & GLUSHKOV_LAST) {\n\
+            st->last = 1;\n\
+        }\n\
+        i = 1;\n\
+    }\n\
+    for (; i < len && d != 0; ++i) {\n\
+        d = glushkov_follow(d) & glushkov_mask[buf[i]];\n\
+        if (d & GLUSHKOV_LAST) {\n\
+            st->last = st->pos + i + 1;\n\
+        }\n\
+    }\n\
+    st->d = d;\n\
+    st->pos += len;\n\
+    return d != 0;\n\
+}\n\
+\n\
+ptrdiff_t match_finish(match_state_t *st) {\n\
+    return st->last;\n\
+}\n");
+}
+
+// match_batch() runs BATCH_LANES inputs in lockstep like the table DFA's in
+// to-dfa.c, with one uint64_t of positions per lane instead of a state.
+// No positions is the dead state, and stays so.
+#define BATCH_LANES 4
+#define BATCH_STRETCH 16
+
+// a lane reads its first byte when it starts, so that the stretches only
+// need glushkov_follow()
+static void emit_lane_start(int l, const char *indent, FILE *out) {
+    fprintf(out, "\
+%sb%d = p%d = bufs[next];\n\
+%se%d = b%d + lens[next];\n\
+%sid%d = next++;\n\
+%sd%d = 0;\n\
+%sh%d = GLUSHKOV_NULLABLE ? 0 : -1;\n\
+%sif (p%d != e%d) {\n\
+%s    d%d = GLUSHKOV_FIRST & glushkov_mask[*p%d++];\n\
+%s    h%d = d%d & GLUSHKOV_LAST ? 1 : h%d;\n\
+%s}\n",
+            indent, l, l, indent, l, l, indent, l, indent, l, indent, l,
+            indent, l, l, indent, l, l, indent, l, l, l, indent);
+}
+
+static void emit_batch(FILE *out) {
+    fprintf(out, "\n\
+// finishes a lane on its own once there are no inputs left to interleave\n\
+static ptrdiff_t match_resume(uint64_t d, const unsigned char *p, const unsigned char *end,\n\
+        const unsigned char *buf, ptrdiff_t last) {\n\
+    for (; p != end && d != 0; ++p) {\n\
+        d = glushkov_follow(d) & glushkov_mask[*p];\n\
+        if (d & GLUSHKOV_LAST) {\n\
+            last = p + 1 - buf;\n\
+        }\n\
+    }\n\
+    return last;\n\
+}\n\
+\n\
+void match_batch(const unsigned char **bufs, const size_t *lens, size_t n, ptrdiff_t *out) {\n\
+    size_t next = 0;\n\
+    if (n < %d) {\n\
+        for (; next < n; ++next) {\n\
+            out[next] = match_n(bufs[next], lens[next]);\n\
+        }\n\
+        return;\n\
+    }\n\
+\n", BATCH_LANES);
+
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+    const unsigned char *b%d, *p%d, *e%d;\n\
+    size_t id%d;\n\
+    uint64_t d%d;\n\
+    ptrdiff_t h%d;\n", l, l, l, l, l, l);
+        emit_lane_start(l, "    ", out);
+    }
+
+    fprintf(out, "\n    for (;;) {\n");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+        while (p%d == e%d || d%d == 0) {\n\
+            out[id%d] = h%d;\n\
+            id%d = SIZE_MAX;\n\
+            if (next == n) {\n\
+                goto drain;\n\
+            }\n", l, l, l, l, l, l);
+        emit_lane_start(l, "            ", out);
+        fprintf(out, "        }\n");
+    }
+
+    fprintf(out, "\n        size_t stretch = %d;\n", BATCH_STRETCH);
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+        if ((size_t)(e%d - p%d) < stretch) {\n\
+            stretch = e%d - p%d;\n\
+        }\n", l, l, l, l);
+    }
+    // a%d is 1 + the last accepting step of the stretch, 0 if none
+    fprintf(out, "        size_t");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "%s a%d = 0", l ? "," : "", l);
+    }
+    fprintf(out, ";\n        for (size_t i = 0; i < stretch; ++i) {\n");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+            d%d = glushkov_follow(d%d) & glushkov_mask[p%d[i]];\n\
+            a%d = d%d & GLUSHKOV_LAST ? i + 1 : a%d;\n", l, l, l, l, l, l);
+    }
+    fprintf(out, "        }\n");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+        if (a%d != 0) {\n\
+            h%d = p%d - b%d + a%d;\n\
+        }\n\
+        p%d += stretch;\n", l, l, l, l, l, l);
+    }
+    fprintf(out, "    }\n\ndrain:\n");
+    for (int l = 0; l < BATCH_LANES; ++l) {
+        fprintf(out, "\
+    if (id%d != SIZE_MAX) {\n\
+        out[id%d] = match_resume(d%d, p%d, e%d, b%d, h%d);\n\
+    }\n", l, l, l, l, l, l, l);
+    }
+    fprintf(out, "}\n");
+}
+
+extern void to_glushkov(RegexNode *regex, bool profile, FILE *out) {
+    Positions pos;
+    pos.size = 0;
+    stats_begin("glushkov");
+    if (glushkov_positions(regex) > GLUSHKOV_MAX_POSITIONS) {
+        panic("too many positions for the glushkov backend");
+    }
+    Fragment whole = build_regex(&pos, regex);
+    stats_end();
+    stats_add("positions", pos.size);
+
+    stats_begin("emit");
+    fprintf(out, "\
+// %.*s\n\
+// %d positions, bit parallel\n\
+#include <stddef.h>\n\
+#include <stdint.h>\n\
+#include <string.h>\n", regex->anno_len, regex->anno_start, pos.size);
+    if (profile) {
+        fprintf(out, "#include <stdio.h>\n");
+        emit_profile_counters("match_n", out);
+    }
+    emit_masks(&pos, out);
+    emit_follow(&pos, out);
+    int spans[GLUSHKOV_MAX_SPANS];
+    int span_count = emit_spans(&pos, spans, out);
+    emit_match(&whole, spans, span_count, profile, out);
+    if (profile) {
+        emit_profile_wrapper("match_n", "const unsigned char *buf, size_t len", "buf, len", out);
+        emit_profile_dump_begin(out);
+        emit_profile_dump_row("match_n", regex->anno_start, regex->anno_len, out);
+        emit_profile_dump_end(out);
+    }
+    fprintf(out, "\n\
+int match(char *str) {\n\
+    return (int)match_n((const unsigned char *)str, strlen(str));\n\
+}\n");
+    emit_stream_api(out);
+    emit_batch(out);
+    stats_end();
+    stats_begin("search");
+    emit_search(regex, out);
+    stats_end();
+}
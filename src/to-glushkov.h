@@ -0,0 +1,21 @@
+#ifndef TO_GLUSHKOV_H_
+#define TO_GLUSHKOV_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "regtree.h"
+
+// Position automata with one bit per position fit in a uint64_t
+#define GLUSHKOV_MAX_POSITIONS 64
+
+// The number of positions (simple atoms, once for every copy a bounded
+// repetition makes) in the Glushkov automaton of the regex, or
+// GLUSHKOV_MAX_POSITIONS + 1 when there are more than fit.
+extern int glushkov_positions(RegexNode *regex);
+// Emits match_n() and friends that run the position automaton bit
+// parallel: the active positions are a uint64_t, and every byte is a few
+// shifts, ands and ors. The regex must not have too many positions.
+extern void to_glushkov(RegexNode *regex, bool profile, FILE *out);
+
+#endif
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "xutils.h"
+#include "regtree.h"
+#include "nfa.h"
+#include "nfa-table.h"
+#include "byteclass.h"
+#include "search.h"
+#include "profile.h"
+#include "stats.h"
+#include "to-lazy.h"
+
+// The cache lives behind a thread local pointer, so that the threads of
+// the -g main() each get their own. Row 0 of lazy_nfa is the start state.
+static void emit_runtime(FILE *out) {
+    fprintf(out, "\n\
+#ifndef R2C_LAZY_CACHE_STATES\n\
+#define R2C_LAZY_CACHE_STATES 1024\n\
+#endif\n\
+// the NFA states of all cached DFA states share one pool; a set never has\n\
+// more than LAZY_NFA_SIZE of them, so an empty pool always fits two sets\n\
+#define LAZY_POOL_SIZE (8 * R2C_LAZY_CACHE_STATES + 2 * LAZY_NFA_SIZE)\n\
+#define LAZY_SLOTS (2 * R2C_LAZY_CACHE_STATES)\n\
+#define LAZY_UNKNOWN -2\n\
+#define LAZY_DEAD -1\n\
+\n\
+typedef struct {\n\
+    int32_t next[R2C_LAZY_CACHE_STATES][LAZY_CLASSES];  // LAZY_UNKNOWN until taken once\n\
+    uint32_t set_offset[R2C_LAZY_CACHE_STATES];\n\
+    uint32_t set_len[R2C_LAZY_CACHE_STATES];\n\
+    uint8_t accepting[R2C_LAZY_CACHE_STATES];\n\
+    int32_t slots[LAZY_SLOTS];  // set hash -> state, -1 for empty slots\n\
+    uint32_t pool[LAZY_POOL_SIZE];\n\
+    uint32_t size, pool_size;\n\
+    int32_t start;\n\
+    unsigned long long built, flushes;\n\
+\n\
+    // scratch space for epsilon closures\n\
+    uint32_t stamp;\n\
+    uint32_t mark[LAZY_NFA_SIZE];\n\
+    uint32_t stack[LAZY_NFA_SIZE];\n\
+    uint32_t closure[LAZY_NFA_SIZE];\n\
+} lazy_cache_t;\n\
+\n\
+static _Thread_local lazy_cache_t *lazy_cache;\n\
+\n\
+static void lazy_flush(lazy_cache_t *c) {\n\
+    c->size = 0;\n\
+    c->pool_size = 0;\n\
+    c->start = LAZY_UNKNOWN;\n\
+    for (size_t i = 0; i < LAZY_SLOTS; ++i) {\n\
+        c->slots[i] = -1;\n\
+    }\n\
+}\n\
+\n\
+static lazy_cache_t *lazy_cache_get(void) {\n\
+    if (lazy_cache == NULL) {\n\
+        lazy_cache = malloc(sizeof(lazy_cache_t));\n\
+        if (lazy_cache == NULL) {\n\
+            abort();\n\
+        }\n\
+        lazy_cache->built = 0;\n\
+        lazy_cache->flushes = 0;\n\
+        lazy_cache->stamp = 0;\n\
+        memset(lazy_cache->mark, 0, sizeof(lazy_cache->mark));\n\
+        lazy_flush(lazy_cache);\n\
+    }\n\
+    return lazy_cache;\n\
+}\n\
+\n\
+void match_cache_free(void) {\n\
+    free(lazy_cache);\n\
+    lazy_cache = NULL;\n\
+}\n\
+\n\
+static void lazy_new_stamp(lazy_cache_t *c) {\n\
+    if (++c->stamp == 0) {\n\
+        memset(c->mark, 0, sizeof(c->mark));\n\
+        c->stamp = 1;\n\
+    }\n\
+}\n\
+\n\
+static void lazy_push(lazy_cache_t *c, uint32_t *top, uint32_t s) {\n\
+    if (s != LAZY_NONE && c->mark[s] != c->stamp) {\n\
+        c->mark[s] = c->stamp;\n\
+        c->stack[(*top)++] = s;\n\
+    }\n\
+}\n\
+\n\
+static int lazy_cmp(const void *a, const void *b) {\n\
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;\n\
+    return (x > y) - (x < y);\n\
+}\n\
+\n\
+// the epsilon closure of the `top` states on the stack, sorted into\n\
+// c->closure; only LAZY_CHARSET and LAZY_MATCH states are kept\n\
+static uint32_t lazy_closure(lazy_cache_t *c, uint32_t top) {\n\
+    uint32_t len = 0;\n\
+    while (top > 0) {\n\
+        uint32_t s = c->stack[--top];\n\
+        if (lazy_nfa[s][0] == LAZY_SPLIT) {\n\
+            lazy_push(c, &top, lazy_nfa[s][1]);\n\
+            lazy_push(c, &top, lazy_nfa[s][2]);\n\
+        } else {\n\
+            c->closure[len++] = s;\n\
+        }\n\
+    }\n\
+    if (len > 32 && LAZY_NFA_SIZE / len <= 32) {\n\
+        // big sets come out sorted faster from the marks\n\
+        len = 0;\n\
+        for (uint32_t s = 0; s < LAZY_NFA_SIZE; ++s) {\n\
+            if (c->mark[s] == c->stamp && lazy_nfa[s][0] != LAZY_SPLIT) {\n\
+                c->closure[len++] = s;\n\
+            }\n\
+        }\n\
+        return len;\n\
+    } else if (len > 32) {\n\
+        qsort(c->closure, len, sizeof(uint32_t), lazy_cmp);\n\
+        return len;\n\
+    }\n\
+    for (uint32_t i = 1; i < len; ++i) {\n\
+        uint32_t s = c->closure[i], j = i;\n\
+        for (; j > 0 && c->closure[j - 1] > s; --j) {\n\
+            c->closure[j] = c->closure[j - 1];\n\
+        }\n\
+        c->closure[j] = s;\n\
+    }\n\
+    return len;\n\
+}\n\
+\n\
+// the cached state for the set in c->closure; a new one flushes the whole\n\
+// cache first when there is no room left\n\
+static int32_t lazy_intern(lazy_cache_t *c, uint32_t len) {\n\
+    if (len == 0) {\n\
+        return LAZY_DEAD;\n\
+    }\n\
+    uint32_t hash = 2166136261u;\n\
+    for (uint32_t i = 0; i < len; ++i) {\n\
+        hash ^= c->closure[i];\n\
+        hash *= 16777619u;\n\
+    }\n\
+    size_t slot = hash %% LAZY_SLOTS;\n\
+    while (c->slots[slot] != -1) {\n\
+        int32_t id = c->slots[slot];\n\
+        if (c->set_len[id] == len\n\
+                && !memcmp(c->pool + c->set_offset[id], c->closure, len * sizeof(uint32_t))) {\n\
+            return id;\n\
+        }\n\
+        slot = (slot + 1) %% LAZY_SLOTS;\n\
+    }\n\
+\n\
+    if (c->size == R2C_LAZY_CACHE_STATES || c->pool_size + len > LAZY_POOL_SIZE) {\n\
+        lazy_flush(c);\n\
+        c->flushes += 1;\n\
+        slot = hash %% LAZY_SLOTS;\n\
+    }\n\
+    int32_t id = c->size++;\n\
+    memcpy(c->pool + c->pool_size, c->closure, len * sizeof(uint32_t));\n\
+    c->set_offset[id] = c->pool_size;\n\
+    c->set_len[id] = len;\n\
+    c->pool_size += len;\n\
+    c->accepting[id] = 0;\n\
+    for (uint32_t i = 0; i < len; ++i) {\n\
+        c->accepting[id] |= lazy_nfa[c->closure[i]][0] == LAZY_MATCH;\n\
+    }\n\
+    for (int k = 0; k < LAZY_CLASSES; ++k) {\n\
+        c->next[id][k] = LAZY_UNKNOWN;\n\
+    }\n\
+    c->slots[slot] = id;\n\
+    c->built += 1;\n\
+    return id;\n\
+}\n\
+\n\
+static int32_t lazy_start(lazy_cache_t *c) {\n\
+    if (c->start == LAZY_UNKNOWN) {\n\
+        uint32_t top = 0;\n\
+        lazy_new_stamp(c);\n\
+        lazy_push(c, &top, 0);\n\
+        c->start = lazy_intern(c, lazy_closure(c, top));\n\
+    }\n\
+    return c->start;\n\
+}\n\
+\n\
+// the transition of `state` on `cls`, taken for the first time\n\
+static int32_t lazy_step(lazy_cache_t *c, int32_t state, unsigned cls) {\n\
+    const uint32_t *set = c->pool + c->set_offset[state];\n\
+    uint32_t top = 0;\n\
+    lazy_new_stamp(c);\n\
+    for (uint32_t i = 0; i < c->set_len[state]; ++i) {\n\
+        const LAZY_ROW_TYPE *s = lazy_nfa[set[i]];\n\
+        if (s[0] == LAZY_CHARSET && (lazy_class_set[s[2]][cls >> 5] >> (cls & 31) & 1)) {\n\
+            lazy_push(c, &top, s[1]);\n\
+        }\n\
+    }\n\
+    unsigned long long flushes = c->flushes;\n\
+    int32_t next = lazy_intern(c, lazy_closure(c, top));\n\
+    if (c->flushes == flushes) {\n\
+        c->next[state][cls] = next;\n\
+    }\n\
+    return next;\n\
+}\n");
+}
+
+static void emit_lazy_match(bool profile, FILE *out) {
+    fprintf(out, "\n\
+%sptrdiff_t match_n%s(const unsigned char *buf, size_t len) {\n\
+    lazy_cache_t *c = lazy_cache_get();\n\
+    int32_t state = lazy_start(c);\n\
+    ptrdiff_t last = c->accepting[state] ? 0 : -1;\n\
+    for (size_t i = 0; i < len; ++i) {\n\
+        unsigned cls = lazy_byte_class[buf[i]];\n\
+        int32_t next = c->next[state][cls];\n\
+        if (next == LAZY_UNKNOWN) {\n\
+            next = lazy_step(c, state, cls);\n\
+        }\n\
+        if (next == LAZY_DEAD) {\n\
+            break;\n\
+        }\n\
+        state = next;\n\
+        if (c->accepting[state]) {\n\
+            last = i + 1;\n\
+        }\n\
+    }\n\
+    return last;\n\
+}\n", profile ? "static " : "", profile ? "_body" : "");
+}
+
+// -p: besides the match_n() counters, how the calling thread's cache fared
+static void emit_profile_epilogue(RegexNode *regex, FILE *out) {
+    emit_profile_wrapper("match_n", "const unsigned char *buf, size_t len", "buf, len", out);
+    emit_profile_dump_begin(out);
+    emit_profile_dump_row("match_n", regex->anno_start, regex->anno_len, out);
+    fprintf(out, "\
+    lazy_cache_t *c = lazy_cache_get();\n\
+    fprintf(out, \"    %%u cached states, %%llu built, %%llu cache flushes\\n\",\n\
+            (unsigned)c->size, c->built, c->flushes);\n");
+    emit_profile_dump_end(out);
+}
+
+extern void to_lazy(RegexNode *regex, bool profile, FILE *out) {
+    ByteClasses classes;
+    stats_begin("byteclass");
+    byteclasses_from_regtree(regex, &classes);
+    stats_end();
+    stats_add("byte_classes", classes.size);
+
+    stats_begin("nfa");
+    Nfa *nfa = nfa_from_regtree(regex);
+    NfaTable table;
+    nfa_table_from_nfa(nfa, &table);
+    stats_end();
+    stats_add("nfa_states", nfa->size);
+    stats_add("lazy_nfa_states", table.size);
+
+    stats_begin("emit");
+    fprintf(out, "\
+// %.*s\n\
+// %d NFA states, %d byte classes, lazy DFA\n\
+#include <stddef.h>\n\
+#include <stdint.h>\n\
+#include <stdlib.h>\n\
+#include <string.h>\n", regex->anno_len, regex->anno_start, table.size, classes.size);
+    if (profile) {
+        fprintf(out, "#include <stdio.h>\n");
+        emit_profile_counters("match_n", out);
+    }
+    emit_nfa_table(nfa, &table, &classes, "lazy", out);
+    emit_runtime(out);
+    emit_lazy_match(profile, out);
+    if (profile) {
+        emit_profile_epilogue(regex, out);
+    }
+    fprintf(out, "\n\
+int match(char *str) {\n\
+    return (int)match_n((const unsigned char *)str, strlen(str));\n\
+}\n");
+    stats_end();
+    stats_begin("search");
+    emit_search(regex, out);
+    stats_end();
+
+    nfa_table_drop(&table);
+    nfa_drop(nfa);
+}
@@ -0,0 +1,15 @@
+#ifndef TO_LAZY_H_
+#define TO_LAZY_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "regtree.h"
+
+// Emits the Thompson NFA and a runtime that builds DFA states the first
+// time match_n() needs them, into a cache of R2C_LAZY_CACHE_STATES states
+// that is flushed when it fills up. Patterns whose DFA would explode only
+// pay for the states their input actually reaches.
+extern void to_lazy(RegexNode *regex, bool profile, FILE *out);
+
+#endif
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "xutils.h"
+#include "regtree.h"
+#include "search.h"
+#include "span.h"
+#include "trie.h"
+#include "profile.h"
+#include "stats.h"
+#include "to-tree.h"
+
+// -p: the functions that count, in the order they were emitted
+typedef struct {
+    char name[16];
+    const char *anno_start;
+    int anno_len;
+    RegexNode *regex;   // regexNNN also counts each branch
+} Profiled;
+
+typedef struct {
+    bool profile;
+    // the next number for each kind of function
+    int atoms, pieces, branches, regexes;
+    Profiled *profiled;
+    int profiled_size, profiled_capacity;
+    // the bitmaps emitted so far, every atom with the same charset shares one
+    Charset *bitmaps;
+    int bitmaps_size, bitmaps_capacity;
+} TreeEmitter;
+
+static int translate_regex(TreeEmitter *e, RegexNode *regex, FILE *out);
+
+// a profiled function is emitted as a static NAME_body(), see profile.h
+static const char *body_linkage(TreeEmitter *e) {
+    return e->profile ? "static " : "";
+}
+
+static const char *body_suffix(TreeEmitter *e) {
+    return e->profile ? "_body" : "";
+}
+
+static void begin_profiled(TreeEmitter *e, const char *kind, int id, FILE *out) {
+    if (e->profile) {
+        char name[16];
+        snprintf(name, sizeof(name), "%s%03d", kind, id);
+        emit_profile_counters(name, out);
+    }
+}
+
+static void end_profiled(TreeEmitter *e, const char *kind, int id, const char *anno_start, int anno_len, RegexNode *regex, FILE *out) {
+    if (!e->profile) {
+        return;
+    }
+    if (e->profiled_size == e->profiled_capacity) {
+        e->profiled_capacity = e->profiled_capacity ? e->profiled_capacity * 2 : 64;
+        e->profiled = xrealloc(e->profiled, e->profiled_capacity * sizeof(Profiled));
+    }
+    Profiled *entry = &e->profiled[e->profiled_size++];
+    snprintf(entry->name, sizeof(entry->name), "%s%03d", kind, id);
+    entry->anno_start = anno_start;
+    entry->anno_len = anno_len;
+    entry->regex = regex;
+    emit_profile_wrapper(entry->name,
+            "const unsigned char *str, const unsigned char *end", "str, end", out);
+}
+
+static void emit_dump_stats(TreeEmitter *e, FILE *out) {
+    emit_profile_dump_begin(out);
+    for (int i = 0; i < e->profiled_size; ++i) {
+        Profiled *entry = &e->profiled[i];
+        emit_profile_dump_row(entry->name, entry->anno_start, entry->anno_len, out);
+        for (int j = 0; entry->regex != NULL && j < entry->regex->size; ++j) {
+            BranchNode *branch = entry->regex->branches[j];
+            fprintf(out, "\
+    fprintf(out, \"    branch %%d: tried %%llu, won %%llu  %%s\\n\", %d, %s_tried[%d], %s_won[%d], ",
+                    j, entry->name, j, entry->name, j);
+            emit_c_string(branch->anno_start, branch->anno_len, out);
+            fprintf(out, ");\n");
+        }
+    }
+    emit_profile_dump_end(out);
+}
+
+#define ATOM_MAX_RANGES 2
+
+static int emit_bitmap(TreeEmitter *e, const Charset *allowed, FILE *out) {
+    for (int i = 0; i < e->bitmaps_size; ++i)
+        if (!memcmp(&e->bitmaps[i], allowed, sizeof(Charset)))
+            return i;
+    if (e->bitmaps_size == e->bitmaps_capacity) {
+        e->bitmaps_capacity = e->bitmaps_capacity ? e->bitmaps_capacity * 2 : 16;
+        e->bitmaps = xrealloc(e->bitmaps, e->bitmaps_capacity * sizeof(Charset));
+    }
+    e->bitmaps[e->bitmaps_size] = *allowed;
+
+    fprintf(out, "static const uint8_t bitmap%03d[32] = {\n", e->bitmaps_size);
+    for (int i = 0; i < 32; ++i)
+        fprintf(out, "%s0x%02x,%s", i % 16 == 0 ? "    " : " ", allowed->bits[i],
+                i % 16 == 15 ? "\n" : "");
+    fprintf(out, "};\n\n");
+    return e->bitmaps_size++;
+}
+
+static int translate_atom(TreeEmitter *e, AtomNode *atom, FILE *out) {
+    if (atom->is_simple_atom) {
+        // like the scalar span%03d(), a few runs of bytes are compared
+        // against, other charsets are one load and a bit test
+        int lo[256], hi[256], clo[256], chi[256];
+        int size = charset_ranges(&atom->allowed, true, lo, hi);
+        int csize = charset_ranges(&atom->allowed, false, clo, chi);
+        bool want = size <= csize;
+        int rsize = want ? size : csize;
+        int bitmap = rsize > ATOM_MAX_RANGES ? emit_bitmap(e, &atom->allowed, out) : -1;
+        begin_profiled(e, "atom", e->atoms, out);
+        fprintf(out, "\
+%sptrdiff_t atom%03d%s(const unsigned char *str, const unsigned char *end) { // %.*s\n\
+    if (str == end) {\n\
+        return -1;\n\
+    }\n\
+", body_linkage(e), e->atoms, body_suffix(e), atom->anno_len, atom->anno_start);
+        if (size == 0 || csize == 0) {
+            fprintf(out, "    return %d;\n}\n", size == 0 ? -1 : 1);
+        } else if (bitmap != -1) {
+            fprintf(out, "    return (bitmap%03d[*str >> 3] >> (*str & 7)) & 1 ? 1 : -1;\n}\n", bitmap);
+        } else {
+            fprintf(out, "    unsigned char c = *str;\n    return ");
+            emit_range_test(rsize, want ? lo : clo, want ? hi : chi, want, out);
+            fprintf(out, " ? 1 : -1;\n}\n");
+        }
+    } else {
+        int id = translate_regex(e, atom->regex, out);
+
+        begin_profiled(e, "atom", e->atoms, out);
+        fprintf(out, "\
+%sptrdiff_t atom%03d%s(const unsigned char *str, const unsigned char *end) { // %.*s\n\
+    return regex%03d(str, end);\n\
+}\n\
+", body_linkage(e), e->atoms, body_suffix(e), atom->anno_len, atom->anno_start, id);
+    }
+    end_profiled(e, "atom", e->atoms, atom->anno_start, atom->anno_len, NULL, out);
+
+    return e->atoms++;
+}
+
+// A repeated charset matches one byte per repetition, so the whole piece is
+// the run of allowed bytes, capped at max: a SIMD kernel finds it without a
+// call per repetition, however large the bounds are.
+static bool piece_uses_span(PieceNode *piece) {
+    return piece->atom->is_simple_atom && (piece->max == -1 || piece->max > 1);
+}
+
+static int translate_piece(TreeEmitter *e, PieceNode *piece, FILE *out) {
+    if (piece_uses_span(piece)) {
+        // the span stands in for the atom, which would go unused
+        begin_profiled(e, "piece", e->pieces, out);
+        emit_span(e->pieces, &piece->atom->allowed, piece->anno_start, piece->anno_len, out);
+        fprintf(out, "\n\
+%sptrdiff_t piece%03d%s(const unsigned char *str, const unsigned char *end) { // %.*s\n\
+    size_t len = end - str;\n", body_linkage(e), e->pieces, body_suffix(e), piece->anno_len, piece->anno_start);
+        if (piece->max != -1) {
+            fprintf(out, "\
+    if (len > %d) {\n\
+        len = %d;\n\
+    }\n", piece->max, piece->max);
+        }
+        fprintf(out, "    len = span%03d(str, len);\n", e->pieces);
+        if (piece->min > 0) {
+            fprintf(out, "    return len < %d ? -1 : (ptrdiff_t)len;\n}\n", piece->min);
+        } else {
+            fprintf(out, "    return len;\n}\n");
+        }
+        end_profiled(e, "piece", e->pieces, piece->anno_start, piece->anno_len, NULL, out);
+        return e->pieces++;
+    }
+
+    int id = translate_atom(e, piece->atom, out);
+    begin_profiled(e, "piece", e->pieces, out);
+    fprintf(out, "\n\
+%sptrdiff_t piece%03d%s(const unsigned char *str, const unsigned char *end) { // %.*s\n\
+    const unsigned char *str_old = str;\n\
+    for (int i = 0; i < %d; ++i) {\n\
+        ptrdiff_t len = atom%03d(str, end);\n\
+        if (len == -1) {\n\
+            return -1;\n\
+        } else {\n\
+            str += len;\n\
+        }\n\
+    }\n\
+", body_linkage(e), e->pieces, body_suffix(e), piece->anno_len, piece->anno_start, piece->min, id);
+
+    if (piece->max == -1) {
+        fprintf(out, "\n\
+    int allow_empty_match = 1;\n\
+    for (;;) {\n\
+        ptrdiff_t len = atom%03d(str, end);\n\
+        if (len == -1) {\n\
+            break;\n\
+        } else if (len == 0) {\n\
+            if (allow_empty_match) {\n\
+                allow_empty_match = 0;\n\
+            } else {\n\
+                break;\n\
+            }\n\
+        } else {\n\
+            str += len;\n\
+        }\n\
+    }\n\
+", id);
+    } else {
+        fprintf(out, "\n\
+    for (int i = %d; i < %d; ++i) {\n\
+        ptrdiff_t len = atom%03d(str, end);\n\
+        if (len == -1) {\n\
+            break;\n\
+        } else {\n\
+            str += len;\n\
+        }\n\
+    }\n\
+", piece->min, piece->max, id);
+    }
+
+    fprintf(out, "\
+    return str - str_old;\n\
+}\n");
+    end_profiled(e, "piece", e->pieces, piece->anno_start, piece->anno_len, NULL, out);
+
+    return e->pieces++;
+}
+
+static int translate_branch(TreeEmitter *e, BranchNode *branch, FILE *out) {
+    int *pieces = malloc(sizeof(int) * branch->size);
+    for (int i = 0; i < branch->size; ++i)
+        pieces[i] = translate_piece(e, branch->pieces[i], out);
+    begin_profiled(e, "branch", e->branches, out);
+    fprintf(out, "\n\
+%sptrdiff_t branch%03d%s(const unsigned char *str, const unsigned char *end) { // %.*s\n\
+    const unsigned char *str_old = str;\n\
+", body_linkage(e), e->branches, body_suffix(e), branch->anno_len, branch->anno_start);
+    // an empty branch, as in a| or the ab(c|) prefix factoring leaves
+    if (branch->size > 0)
+        fprintf(out, "    ptrdiff_t len = 0;\n");
+    else
+        fprintf(out, "    (void)end;\n");
+    for (int i = 0; i < branch->size; ++i)
+        fprintf(out, "\n\
+    len = piece%03d(str, end);\n\
+    if (len == -1) {\n\
+        return -1;\n\
+    } else {\n\
+        str += len;\n\
+    }\n\
+", pieces[i]);
+
+    free(pieces);
+
+    fprintf(out, "\
+    return str - str_old;\n\
+}\n");
+    end_profiled(e, "branch", e->branches, branch->anno_start, branch->anno_len, NULL, out);
+    return e->branches++;
+}
+
+static int translate_regex(TreeEmitter *e, RegexNode *regex, FILE *out) {
+    Trie trie;
+    if (trie_from_regex(regex, &trie)) {
+        stats_add("trie_nodes", trie.size);
+        emit_trie(e->regexes, &trie, regex->anno_start, regex->anno_len, out);
+        trie_drop(&trie);
+        begin_profiled(e, "regex", e->regexes, out);
+        fprintf(out, "\n\
+%sptrdiff_t regex%03d%s(const unsigned char *str, const unsigned char *end) { // %.*s\n\
+    return trie%03d(str, end);\n\
+}\n", body_linkage(e), e->regexes, body_suffix(e), regex->anno_len, regex->anno_start, e->regexes);
+        end_profiled(e, "regex", e->regexes, regex->anno_start, regex->anno_len, NULL, out);
+        return e->regexes++;
+    }
+
+    int *branches = malloc(sizeof(int) * regex->size);
+    for (int i = 0; i < regex->size; ++i)
+        branches[i] = translate_branch(e, regex->branches[i], out);
+    begin_profiled(e, "regex", e->regexes, out);
+    if (e->profile) {
+        fprintf(out, "static unsigned long long regex%03d_tried[%d], regex%03d_won[%d];\n",
+                e->regexes, regex->size, e->regexes, regex->size);
+    }
+    fprintf(out, "\n\
+%sptrdiff_t regex%03d%s(const unsigned char *str, const unsigned char *end) { // %.*s\n\
+    ptrdiff_t len = 0;\n\
+    ptrdiff_t max = -1;\n\
+", body_linkage(e), e->regexes, body_suffix(e), regex->anno_len, regex->anno_start);
+    if (e->profile) {
+        fprintf(out, "    int won = -1;\n");
+    }
+    for (int i = 0; i < regex->size; ++i) {
+        fprintf(out, "\n\
+    len = branch%03d(str, end);\n", branches[i]);
+        if (e->profile) {
+            fprintf(out, "\
+    regex%03d_tried[%d] += 1;\n\
+    if (len > max) {\n\
+        max = len;\n\
+        won = %d;\n\
+    }\n", e->regexes, i, i);
+        } else {
+            fprintf(out, "\
+    if (len > max) {\n\
+        max = len;\n\
+    }\n");
+        }
+    }
+
+    if (e->profile) {
+        fprintf(out, "\
+    if (won >= 0) {\n\
+        regex%03d_won[won] += 1;\n\
+    }\n", e->regexes);
+    }
+    fprintf(out, "\
+    return max;\n\
+}\n");
+    end_profiled(e, "regex", e->regexes, regex->anno_start, regex->anno_len, regex, out);
+
+    free(branches);
+    return e->regexes++;
+}
+
+static bool has_span(RegexNode *regex) {
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        for (int j = 0; j < branch->size; ++j) {
+            PieceNode *piece = branch->pieces[j];
+            if (piece->atom->is_simple_atom ? piece_uses_span(piece) : has_span(piece->atom->regex)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+extern void to_tree(RegexNode *regex, bool profile, FILE *out) {
+    fprintf(out, "\
+#include <stddef.h>\n\
+#include <stdint.h>\n\
+#include <string.h>\n");
+    if (profile) {
+        fprintf(out, "#include <stdio.h>\n");
+    }
+    if (has_span(regex)) {
+        emit_span_prologue(out);
+    }
+    fprintf(out, "\n");
+    stats_begin("emit");
+    TreeEmitter emitter = { .profile = profile };
+    TreeEmitter *e = &emitter;
+    int id = translate_regex(e, regex, out);
+    fprintf(out, "\n\
+ptrdiff_t match_n(const unsigned char *buf, size_t len) {\n\
+    return regex%03d(buf, buf + len);\n\
+}\n\
+\n\
+int match(char *str) {\n\
+    return (int)match_n((const unsigned char *)str, strlen(str));\n\
+}\n", id);
+    if (profile) {
+        emit_dump_stats(e, out);
+    }
+    stats_end();
+    stats_begin("search");
+    emit_search(regex, out);
+    stats_end();
+    free(e->profiled);
+    free(e->bitmaps);
+}
@@ -0,0 +1,14 @@
+#ifndef TO_TREE_H_
+#define TO_TREE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "regtree.h"
+
+// Emits one C function per node of the regex tree: atomNNN, pieceNNN,
+// branchNNN and regexNNN, numbered from 000 for every call. Pieces are
+// greedy and never backtrack, and a regex returns its longest branch.
+extern void to_tree(RegexNode *regex, bool profile, FILE *out);
+
+#endif
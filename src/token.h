@@ -1,6 +1,13 @@
 #ifndef TOKEN_H_
 #define TOKEN_H_
 
+#include <stdbool.h>
+
+#include "charset.h"
+
+// the largest count allowed in a bound, the same as glibc's RE_DUP_MAX
+#define DUP_MAX 32767
+
 typedef enum {
     T_CHARSET, T_META, T_UNKNOWN, T_END, T_BOUND
 } TokenTypeTag;
@@ -11,15 +18,21 @@ typedef struct {
     int anno_len;
 
     union {
-        bool allowed[256];
+        Charset allowed;
         int bound[2];
         int metachar;
     };
 } Token;
 
-extern void set_pattern_str(char *str);
-extern Token get_token(void);
-extern char *get_token_annotation(Token t);
-extern void unget_token(Token t);
+// the read position in a pattern, and one token pushed back for lookahead
+typedef struct {
+    const char *pos;
+    Token unget;
+    bool has_unget;
+} Lexer;
+
+extern void lexer_init(Lexer *lexer, const char *str);
+extern Token get_token(Lexer *lexer);
+extern void unget_token(Lexer *lexer, Token t);
 
 #endif
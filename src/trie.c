@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "xutils.h"
+#include "regtree.h"
+#include "trie.h"
+
+// A long list of keywords, (foo|bar|baz|...), is one branch, piece and
+// atom per byte for -b tree, and regexNNN() tries every branch in turn.
+// As a trie, matching walks one node per byte of input: how long that
+// takes depends on the input, not on the number of keywords.
+
+// -2 when `regex` is not a finite set of strings that -b tree matches as
+// one, -1 when its strings differ in length, else their length. -b tree
+// keeps the longest match of a group and never goes back to a shorter one,
+// so a group that something follows has to be fixed width: in (a|ab)c the
+// group takes "ab" of "abc" and the c fails, where the set {ac, abc} would
+// match.
+static int literal_width(RegexNode *regex, bool followed, int *pieces) {
+    int width = 0;
+    for (int i = 0; i < regex->size; ++i) {
+        BranchNode *branch = regex->branches[i];
+        int w = 0;
+        for (int j = 0; j < branch->size; ++j) {
+            PieceNode *piece = branch->pieces[j];
+            if (piece->min != piece->max) {
+                return -2;
+            }
+            if (piece->atom->is_simple_atom) {
+                // coalesce turns the oo of foo into o{2}
+                *pieces += piece->min;
+                w = w == -1 ? -1 : w + piece->min;
+                continue;
+            }
+            *pieces += 1;
+            if (piece->min != 1) {
+                return -2;
+            }
+            bool more = followed || j + 1 < branch->size;
+            int inner = literal_width(piece->atom->regex, more, pieces);
+            if (inner == -2 || (inner == -1 && more)) {
+                return -2;
+            }
+            w = w == -1 || inner == -1 ? -1 : w + inner;
+        }
+        if (i == 0) {
+            width = w;
+        } else if (w != width) {
+            width = -1;
+        }
+    }
+    return width;
+}
+
+typedef struct {
+    int edges;  // the first of the node's edges, sorted by byte, or -1
+    bool final;
+} BuildNode;
+
+typedef struct {
+    int child;
+    int next;
+    unsigned char byte;
+} BuildEdge;
+
+typedef struct {
+    BuildNode *nodes;
+    int size, capacity;
+    BuildEdge *edges;
+    int edge_size, edge_capacity;
+    // charsets and groups multiply the strings, these keep a pattern like
+    // (a|b)[a-z][a-z][a-z] out of the trie
+    int max_nodes;
+    long steps, max_steps;
+} Builder;
+
+// what is left to insert once the branch of a group ends
+typedef struct Rest {
+    BranchNode *branch;
+    int index;
+    const struct Rest *next;
+} Rest;
+
+static int new_node(Builder *b) {
+    if (b->size == b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 64;
+        b->nodes = xrealloc(b->nodes, b->capacity * sizeof(BuildNode));
+    }
+    b->nodes[b->size].edges = -1;
+    b->nodes[b->size].final = false;
+    return b->size++;
+}
+
+// the child of `node` for byte `c`, -1 when the trie grew too large
+static int child(Builder *b, int node, unsigned char c) {
+    int prev = -1, e = b->nodes[node].edges;
+    while (e != -1 && b->edges[e].byte < c) {
+        prev = e;
+        e = b->edges[e].next;
+    }
+    if (e != -1 && b->edges[e].byte == c) {
+        return b->edges[e].child;
+    }
+    if (b->size == b->max_nodes) {
+        return -1;
+    }
+
+    if (b->edge_size == b->edge_capacity) {
+        b->edge_capacity = b->edge_capacity ? b->edge_capacity * 2 : 64;
+        b->edges = xrealloc(b->edges, b->edge_capacity * sizeof(BuildEdge));
+    }
+    int created = new_node(b);
+    int added = b->edge_size++;
+    b->edges[added].child = created;
+    b->edges[added].next = e;
+    b->edges[added].byte = c;
+    if (prev == -1) {
+        b->nodes[node].edges = added;
+    } else {
+        b->edges[prev].next = added;
+    }
+    return created;
+}
+
+static bool insert_regex(Builder *b, int node, RegexNode *regex, const Rest *rest);
+
+// inserts the strings of pieces[index..] of `branch` and then of `rest`
+// behind `node`, the first `done` repetitions of pieces[index] already in
+static bool insert_branch(Builder *b, int node, BranchNode *branch, int index, int done,
+                          const Rest *rest) {
+    if (++b->steps > b->max_steps) {
+        return false;
+    }
+    for (int i = index; i < branch->size; ++i, done = 0) {
+        PieceNode *piece = branch->pieces[i];
+        AtomNode *atom = piece->atom;
+        if (!atom->is_simple_atom) {
+            Rest next = { branch, i + 1, rest };
+            return insert_regex(b, node, atom->regex, &next);
+        }
+
+        int count = 0, only = 0;
+        for (int c = 0; c < 256; ++c) {
+            if (charset_has(&atom->allowed, c)) {
+                count += 1;
+                only = c;
+            }
+        }
+        for (; done < piece->min; ++done) {
+            if (count == 1) {
+                // the bytes of a keyword, without a call each
+                node = child(b, node, only);
+                if (node == -1) {
+                    return false;
+                }
+                continue;
+            }
+            for (int c = 0; c < 256; ++c) {
+                if (!charset_has(&atom->allowed, c)) {
+                    continue;
+                }
+                int next = child(b, node, c);
+                if (next == -1 || !insert_branch(b, next, branch, i, done + 1, rest)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+    if (rest != NULL) {
+        return insert_branch(b, node, rest->branch, rest->index, 0, rest->next);
+    }
+    b->nodes[node].final = true;
+    return true;
+}
+
+static bool insert_regex(Builder *b, int node, RegexNode *regex, const Rest *rest) {
+    for (int i = 0; i < regex->size; ++i) {
+        if (!insert_branch(b, node, regex->branches[i], 0, 0, rest)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+extern bool trie_from_regex(RegexNode *regex, Trie *trie) {
+    int pieces = 0;
+    if (literal_width(regex, false, &pieces) == -2) {
+        return false;
+    }
+
+    Builder b = { 0 };
+    b.max_nodes = 4 * pieces + 256;
+    b.max_steps = 16L * b.max_nodes;
+    new_node(&b);
+    bool ok = insert_regex(&b, 0, regex, NULL);
+
+    int strings = 0;
+    for (int i = 0; ok && i < b.size; ++i) {
+        strings += b.nodes[i].final;
+    }
+    if (!ok || strings < TRIE_MIN_STRINGS) {
+        free(b.nodes);
+        free(b.edges);
+        return false;
+    }
+
+    // breadth first, so that the children of a node are numbered in a row
+    int *order = xmalloc(b.size * sizeof(int));
+    trie->size = b.size;
+    trie->first = xmalloc((b.size + 1) * sizeof(int));
+    trie->byte = xmalloc(b.size);
+    trie->final = xmalloc(b.size * sizeof(bool));
+    order[0] = 0;
+    trie->byte[0] = 0;
+    trie->final[0] = b.nodes[0].final;
+    int size = 1;
+    for (int i = 0; i < b.size; ++i) {
+        trie->first[i] = size;
+        for (int e = b.nodes[order[i]].edges; e != -1; e = b.edges[e].next) {
+            order[size] = b.edges[e].child;
+            trie->byte[size] = b.edges[e].byte;
+            trie->final[size] = b.nodes[b.edges[e].child].final;
+            size += 1;
+        }
+    }
+    trie->first[b.size] = size;
+
+    free(order);
+    free(b.nodes);
+    free(b.edges);
+    return true;
+}
+
+extern bool trie_fits(RegexNode *regex) {
+    Trie trie;
+    if (!trie_from_regex(regex, &trie)) {
+        return false;
+    }
+    trie_drop(&trie);
+    return true;
+}
+
+extern void trie_drop(Trie *trie) {
+    free(trie->first);
+    free(trie->byte);
+    free(trie->final);
+}
+
+static const char *index_type(int count) {
+    if (count <= 0xff) {
+        return "uint8_t";
+    } else if (count <= 0xffff) {
+        return "uint16_t";
+    } else {
+        return "uint32_t";
+    }
+}
+
+static void emit_row(int i, int size, int value, FILE *out) {
+    fprintf(out, "%s%d,%s", i % 16 == 0 ? "    " : " ", value,
+            i % 16 == 15 || i == size - 1 ? "\n" : "");
+}
+
+extern void emit_trie(int id, const Trie *trie, const char *anno_start, int anno_len, FILE *out) {
+    const char *type = index_type(trie->size);
+
+    fprintf(out, "\nstatic const %s trie%03d_first[%d] = {\n", type, id, trie->size + 1);
+    for (int i = 0; i <= trie->size; ++i) {
+        emit_row(i, trie->size + 1, trie->first[i], out);
+    }
+    fprintf(out, "};\n\nstatic const unsigned char trie%03d_byte[%d] = {\n", id, trie->size);
+    for (int i = 0; i < trie->size; ++i) {
+        emit_row(i, trie->size, trie->byte[i], out);
+    }
+    fprintf(out, "};\n\nstatic const unsigned char trie%03d_final[%d] = {\n", id, trie->size);
+    for (int i = 0; i < trie->size; ++i) {
+        emit_row(i, trie->size, trie->final[i], out);
+    }
+    fprintf(out, "};\n");
+
+    fprintf(out, "\n\
+static ptrdiff_t trie%03d(const unsigned char *str, const unsigned char *end) { // %.*s\n\
+    const unsigned char *str_old = str;\n\
+    ptrdiff_t max = trie%03d_final[0] ? 0 : -1;\n\
+    %s node = 0;\n\
+    while (str != end) {\n\
+        // the children of a node are sorted by byte\n\
+        %s lo = trie%03d_first[node], hi = trie%03d_first[node + 1];\n\
+        while (lo < hi) {\n\
+            %s mid = lo + (hi - lo) / 2;\n\
+            if (trie%03d_byte[mid] < *str) {\n\
+                lo = mid + 1;\n\
+            } else {\n\
+                hi = mid;\n\
+            }\n\
+        }\n\
+        if (lo == trie%03d_first[node + 1] || trie%03d_byte[lo] != *str) {\n\
+            break;\n\
+        }\n\
+        node = lo;\n\
+        str += 1;\n\
+        if (trie%03d_final[node]) {\n\
+            max = str - str_old;\n\
+        }\n\
+    }\n\
+    return max;\n\
+}\n", id, anno_len, anno_start, id, type, type, id, id, type, id, id, id, id);
+}
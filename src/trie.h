@@ -0,0 +1,34 @@
+#ifndef TRIE_H_
+#define TRIE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "regtree.h"
+
+// fewer strings than this are left to one function per node
+#define TRIE_MIN_STRINGS 8
+
+// The strings of a literal alternation, with nodes numbered breadth first:
+// the children of node `i` are the nodes first[i] .. first[i + 1] - 1,
+// sorted by byte[], the byte that leads to each of them. Node 0 is the root.
+typedef struct {
+    int size;
+    int *first;
+    unsigned char *byte;
+    bool *final;
+} Trie;
+
+// Builds the trie of a regex that matches a finite set of strings, and
+// matches them the way -b tree would: the longest one in front of the
+// input. False when the regex isn't one, would blow up into a trie much
+// larger than the regex, or has fewer than TRIE_MIN_STRINGS strings.
+extern bool trie_from_regex(RegexNode *regex, Trie *trie);
+extern void trie_drop(Trie *trie);
+// whether trie_from_regex() takes `regex`, for -b auto: a DFA of a long
+// keyword list has a state per prefix and takes the compiler minutes
+extern bool trie_fits(RegexNode *regex);
+// trie%03d(str, end): the length of the longest string in front of str
+extern void emit_trie(int id, const Trie *trie, const char *anno_start, int anno_len, FILE *out);
+
+#endif